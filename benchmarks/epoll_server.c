@@ -0,0 +1,122 @@
+/* bpfbench  A better benchmarking tool written in eBPF.
+ * Copyright (C) 2020  William Findlay
+ *
+ * Heavily inspired by syscount from bcc-tools:
+ * https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+/* Epoll echo server: a server thread waits in epoll_wait on several
+ * connections and echoes each 64-byte request, while the main thread
+ * sends one request per connection at a time and reads the replies.
+ * Connections are AF_UNIX socketpairs, so no network is involved.
+ * Every op is one request and its reply.
+ *
+ * usage: epoll_server [ops] */
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "workload.h"
+
+#define CONNECTIONS  8
+#define MESSAGE_SIZE 64
+
+static int client_fds[CONNECTIONS];
+static int server_fds[CONNECTIONS];
+static int epoll_fd;
+
+static void *server(void *arg)
+{
+    struct epoll_event events[CONNECTIONS];
+    char buf[MESSAGE_SIZE];
+    int open = CONNECTIONS;
+    (void)arg;
+
+    while (open) {
+        int n = epoll_wait(epoll_fd, events, CONNECTIONS, -1);
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            ssize_t len = read(fd, buf, sizeof(buf));
+            /* The client closing its end stops the server */
+            if (len <= 0) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+                open--;
+                continue;
+            }
+            if (write(fd, buf, len) != len) {
+                perror("write");
+                return NULL;
+            }
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    long ops = parse_ops(argc, argv, 200000L);
+    char buf[MESSAGE_SIZE] = {0};
+    pthread_t thread;
+
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+    for (int i = 0; i < CONNECTIONS; i++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+            perror("socketpair");
+            return 1;
+        }
+        client_fds[i] = fds[0];
+        server_fds[i] = fds[1];
+        struct epoll_event event = {.events = EPOLLIN, .data.fd = fds[1]};
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[1], &event);
+    }
+    if (pthread_create(&thread, NULL, server, NULL)) {
+        fprintf(stderr, "pthread_create failed\n");
+        return 1;
+    }
+
+    /* Send a batch of one request per connection, then collect the replies */
+    long long start = now_ns();
+    for (long i = 0; i < ops; i += CONNECTIONS) {
+        int batch = ops - i < CONNECTIONS ? ops - i : CONNECTIONS;
+        for (int c = 0; c < batch; c++) {
+            if (write(client_fds[c], buf, sizeof(buf)) != sizeof(buf)) {
+                perror("write");
+                return 1;
+            }
+        }
+        for (int c = 0; c < batch; c++) {
+            if (read(client_fds[c], buf, sizeof(buf)) != sizeof(buf)) {
+                perror("read");
+                return 1;
+            }
+        }
+    }
+    long long elapsed = now_ns() - start;
+
+    for (int i = 0; i < CONNECTIONS; i++) {
+        close(client_fds[i]);
+    }
+    pthread_join(thread, NULL);
+    report(ops, elapsed);
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+/* bpfbench  A better benchmarking tool written in eBPF.
+ * Copyright (C) 2020  William Findlay
+ *
+ * Heavily inspired by syscount from bcc-tools:
+ * https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+/* File I/O: pwrite 4 KiB blocks into a file, then pread them back,
+ * round after round. The file is unlinked, so everything stays in the
+ * page cache and the time is syscall cost, not the disk.
+ *
+ * usage: fd_io [ops] */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "workload.h"
+
+#define BLOCK_SIZE 4096
+#define FILE_BLOCKS 256 /* 1 MiB file */
+
+int main(int argc, char **argv)
+{
+    long ops = parse_ops(argc, argv, 1000000L);
+    char path[] = "/tmp/bpfbench-fd_io-XXXXXX";
+    char buf[BLOCK_SIZE];
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    unlink(path);
+    memset(buf, 'x', sizeof(buf));
+
+    /* Every op is one pwrite64 or pread64 */
+    long long start = now_ns();
+    for (long i = 0; i < ops; i++) {
+        off_t offset = (i % FILE_BLOCKS) * BLOCK_SIZE;
+        ssize_t n = (i / FILE_BLOCKS) % 2 ? pread(fd, buf, BLOCK_SIZE, offset)
+                                          : pwrite(fd, buf, BLOCK_SIZE, offset);
+        if (n != BLOCK_SIZE) {
+            perror("pread/pwrite");
+            return 1;
+        }
+    }
+    long long elapsed = now_ns() - start;
+
+    close(fd);
+    report(ops, elapsed);
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+/* bpfbench  A better benchmarking tool written in eBPF.
+ * Copyright (C) 2020  William Findlay
+ *
+ * Heavily inspired by syscount from bcc-tools:
+ * https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+/* Process creation storm: fork, exec /bin/true and wait, over and over.
+ * Trace it with -f so that bpfbench follows the children.
+ *
+ * usage: fork_storm [ops] */
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "workload.h"
+
+int main(int argc, char **argv)
+{
+    long ops = parse_ops(argc, argv, 2000L);
+    char *const child_argv[] = {"true", NULL};
+
+    long long start = now_ns();
+    for (long i = 0; i < ops; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            execv("/bin/true", child_argv);
+            _exit(127);
+        }
+        int status;
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+            fprintf(stderr, "child %d failed\n", pid);
+            return 1;
+        }
+    }
+    long long elapsed = now_ns() - start;
+
+    report(ops, elapsed);
+
+    return 0;
+}
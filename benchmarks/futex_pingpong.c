@@ -0,0 +1,87 @@
+/* bpfbench  A better benchmarking tool written in eBPF.
+ * Copyright (C) 2020  William Findlay
+ *
+ * Heavily inspired by syscount from bcc-tools:
+ * https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+/* Futex ping-pong: two threads hand a token back and forth through one
+ * lock word, waking each other with FUTEX_WAKE and sleeping in
+ * FUTEX_WAIT. Every op is one round trip, so two wakeups.
+ *
+ * usage: futex_pingpong [ops] */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "workload.h"
+
+static _Atomic int turn; /* 0: main thread's turn, 1: partner's */
+static long ops;
+
+static void futex_wait(_Atomic int *uaddr, int val)
+{
+    syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic int *uaddr)
+{
+    syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Wait until it is <me>'s turn, then give the token to the other thread */
+static void play(int me)
+{
+    while (atomic_load(&turn) != me) {
+        futex_wait(&turn, !me);
+    }
+    atomic_store(&turn, !me);
+    futex_wake(&turn);
+}
+
+static void *partner(void *arg)
+{
+    (void)arg;
+    for (long i = 0; i < ops; i++) {
+        play(1);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    ops = parse_ops(argc, argv, 200000L);
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, partner, NULL)) {
+        fprintf(stderr, "pthread_create failed\n");
+        return 1;
+    }
+
+    long long start = now_ns();
+    for (long i = 0; i < ops; i++) {
+        play(0);
+    }
+    pthread_join(thread, NULL);
+    long long elapsed = now_ns() - start;
+
+    report(ops, elapsed);
+
+    return 0;
+}
@@ -0,0 +1,46 @@
+/* bpfbench  A better benchmarking tool written in eBPF.
+ * Copyright (C) 2020  William Findlay
+ *
+ * Heavily inspired by syscount from bcc-tools:
+ * https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+/* Synthetic system call storm: getppid() in a tight loop.
+ * getppid does next to no work in the kernel, so the time per call is
+ * the cost of entering and leaving the kernel plus whatever is attached
+ * to sys_enter and sys_exit. Reports that time per call.
+ *
+ * usage: getppid_storm [ops] */
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "workload.h"
+
+int main(int argc, char **argv)
+{
+    long ops = parse_ops(argc, argv, 10000000L);
+
+    /* Call through syscall(2) so no libc can cache the result */
+    long long start = now_ns();
+    for (long i = 0; i < ops; i++) {
+        syscall(SYS_getppid);
+    }
+    long long elapsed = now_ns() - start;
+
+    report(ops, elapsed);
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#! /usr/bin/env python3
+
+# bpfbench  A better benchmarking tool written in eBPF.
+# Copyright (C) 2020  William Findlay
+#
+# Heavily inspired by syscount from bcc-tools:
+# https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+"""
+Measure what each probe variant of bpfbench costs per traced event,
+by timing a getppid storm without bpfbench and then under every
+combination of clock, filtering mode and histogram on or off.
+Every traced call runs two programs, so ns/event is half the increase
+in ns/call. Build the storm first with make benchmarks.
+"""
+
+import os, sys
+import argparse
+import itertools
+import re
+import statistics
+import subprocess
+
+HERE = os.path.dirname(os.path.realpath(__file__))
+BPFBENCH = os.path.join(HERE, '..', 'bpfbench')
+STORM = os.path.join(HERE, 'build', 'getppid_storm')
+
+CLOCKS = ['mono', 'boot', 'coarse', 'tai']
+# Ways of selecting the storm, see the filtering and micro-benchmark options
+FILTERS = {
+    'pid': [],
+    'allowlist': ['--syscalls', 'getppid'],
+    'dynamic': ['--dynamic'],
+}
+HISTS = {
+    'off': [],
+    'on': ['--hist'],
+}
+
+REPORT = re.compile(r'ns/op ([0-9.]+)')
+
+def run_storm(command):
+    """
+    Run <command>, which ends with the storm, and return its ns/call,
+    or None if it failed, e.g. because the kernel lacks the clock.
+    """
+    proc = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+            universal_newlines=True)
+    match = REPORT.search(proc.stdout)
+    return float(match[1]) if match else None
+
+def median_of(command, runs):
+    """
+    Return the median ns/call of <runs> runs of <command>, or None.
+    """
+    results = [run_storm(command) for _ in range(runs)]
+    if None in results:
+        return None
+    return statistics.median(results)
+
+def parse_args():
+    parser = argparse.ArgumentParser(description='Measure the per-event cost of bpfbench probe variants.')
+    parser.add_argument('--calls', metavar='N', type=int, default=5000000,
+            help='System calls per storm. Defaults to 5000000.')
+    parser.add_argument('--runs', metavar='N', type=int, default=3,
+            help='Runs per variant, the median is reported. Defaults to 3.')
+    parser.add_argument('--clocks', metavar='list', type=lambda s: s.split(','), default=CLOCKS,
+            help=f'Clocks to try. Defaults to {",".join(CLOCKS)}.')
+    parser.add_argument('--filters', metavar='list', type=lambda s: s.split(','), default=list(FILTERS),
+            help=f'Filtering modes to try. Defaults to {",".join(FILTERS)}.')
+    parser.add_argument('--hist', type=str, choices=['off', 'on', 'both'], default='both',
+            help='Whether to try with --hist. Defaults to both.')
+    parser.add_argument('--cpu', metavar='cpu', type=int,
+            help='Pin bpfbench and the storm to this CPU to reduce noise.')
+    args = parser.parse_args()
+    if any(clock not in CLOCKS for clock in args.clocks):
+        parser.error(f'Clocks must be in {",".join(CLOCKS)}.')
+    if any(f not in FILTERS for f in args.filters):
+        parser.error(f'Filtering modes must be in {",".join(FILTERS)}.')
+    if args.calls <= 0 or args.runs <= 0:
+        parser.error('--calls and --runs must be positive.')
+    if not os.access(STORM, os.X_OK):
+        parser.error(f'{STORM} not found, run make -C {HERE} first.')
+    if os.geteuid() != 0:
+        parser.error('This script must be run with root privileges.')
+    return args
+
+def main():
+    args = parse_args()
+    if args.cpu is not None:
+        os.sched_setaffinity(0, {args.cpu})
+    storm = [STORM, str(args.calls)]
+    hists = list(HISTS) if args.hist == 'both' else [args.hist]
+
+    baseline = median_of(storm, args.runs)
+    print(f'Untraced: {baseline:.3f} ns/call')
+    print(f'{"CLOCK":<8s} {"FILTER":<10s} {"HIST":<4s} {"NS/CALL":>10s} {"NS/EVENT":>10s}')
+    for clock, f, hist in itertools.product(args.clocks, args.filters, hists):
+        command = [sys.executable, BPFBENCH, '--clock', clock] + FILTERS[f] + HISTS[hist]
+        traced = median_of(command + ['-r'] + storm, args.runs)
+        if traced is None:
+            print(f'{clock:<8s} {f:<10s} {hist:<4s} {"failed":>10s} {"-":>10s}')
+            continue
+        print(f'{clock:<8s} {f:<10s} {hist:<4s} {traced:>10.3f} {(traced - baseline) / 2:>10.3f}')
+        sys.stdout.flush()
+
+if __name__ == '__main__':
+    main()
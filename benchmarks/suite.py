@@ -0,0 +1,186 @@
+#! /usr/bin/env python3
+
+# bpfbench  A better benchmarking tool written in eBPF.
+# Copyright (C) 2020  William Findlay
+#
+# Heavily inspired by syscount from bcc-tools:
+# https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+"""
+Regression suite for bpfbench's own cost and accuracy.
+Runs every workload in build/ on its own and under bpfbench -r, and
+reports the slowdown, how many of the expected calls bpfbench saw,
+and the latencies it measured. --save keeps the numbers as JSON so a
+later run can be checked against them with --baseline.
+Build the workloads first with make benchmarks.
+"""
+
+import os, sys
+import argparse
+import json
+import platform
+import shlex
+import statistics
+import subprocess
+import tempfile
+
+HERE = os.path.dirname(os.path.realpath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..'))
+
+from src import compare
+
+BPFBENCH = os.path.join(HERE, '..', 'bpfbench')
+BUILD = os.path.join(HERE, 'build')
+
+# name: (ops, extra bpfbench flags, {syscall: expected calls per op} or None)
+WORKLOADS = {
+    'getppid_storm': (5000000, [], {'getppid': 1}),
+    'fork_storm': (2000, ['-f'], {'execve': 1}),
+    'fd_io': (1000000, [], {'pwrite64': 0.5, 'pread64': 0.5}),
+    # How often a thread finds the token already passed varies
+    'futex_pingpong': (200000, [], None),
+    'epoll_server': (200000, [], {'read': 2, 'write': 2}),
+}
+
+def run_workload(command):
+    """
+    Run <command>, which ends with a workload, and return its ns/op.
+    """
+    proc = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+            universal_newlines=True)
+    words = proc.stdout.split()
+    if 'ns/op' not in words:
+        raise RuntimeError(f'{" ".join(command)} failed with status {proc.returncode}')
+    return float(words[words.index('ns/op') + 1])
+
+def measure(name, args, outdir):
+    """
+    Return untraced and traced ns/op of workload <name>, medians of
+    alternating runs, and the results bpfbench reported for the last run.
+    """
+    ops, flags, _ = WORKLOADS[name]
+    workload = [os.path.join(BUILD, name), str(ops)]
+    outfile = os.path.join(outdir, f'{name}.bench')
+    bpfbench = [sys.executable, BPFBENCH, '-o', outfile, '--overwrite'] + flags + args.bpfbench_args
+    untraced, traced = [], []
+    for _ in range(args.runs):
+        untraced.append(run_workload(workload))
+        traced.append(run_workload(bpfbench + ['-r'] + workload))
+    return statistics.median(untraced), statistics.median(traced), compare.load_text(outfile).results
+
+def summarize(name, untraced, traced, results):
+    """
+    Reduce one workload's measurements to what --save keeps.
+    """
+    ops, _, expected = WORKLOADS[name]
+    summary = {
+        'untraced': untraced,
+        'traced': traced,
+        'slowdown': (traced - untraced) / untraced * 100,
+        'syscalls': {k: {'count': v['count'], 'avg_overhead': v['avg_overhead']}
+                for k, v in results.items()},
+        'seen': None,
+    }
+    # Accuracy: calls bpfbench counted out of those the workload made
+    if expected:
+        seen = sum(results.get(k, {}).get('count', 0) for k in expected)
+        summary['seen'] = seen / (ops * sum(expected.values()))
+    return summary
+
+def format_summary(summaries, baseline=None):
+    """
+    Render one line per workload, then its heaviest syscalls.
+    """
+    lines = []
+    header = f'{"WORKLOAD":<16s} {"NS/OP":>12s} {"TRACED":>12s} {"SLOWDOWN(%)":>12s} {"SEEN(%)":>8s}'
+    if baseline:
+        header += f' {"WAS(%)":>8s}'
+    lines.append(header)
+    for name, s in summaries.items():
+        seen = f'{s["seen"] * 100:>8.1f}' if s['seen'] is not None else f'{"-":>8s}'
+        line = f'{name:<16s} {s["untraced"]:>12.3f} {s["traced"]:>12.3f} {s["slowdown"]:>12.1f} {seen}'
+        if baseline:
+            was = baseline.get('workloads', {}).get(name)
+            line += f' {was["slowdown"]:>8.1f}' if was else f' {"-":>8s}'
+        lines.append(line)
+    for name, s in summaries.items():
+        lines.append('')
+        lines.append(f'{name}: latency reported by bpfbench')
+        lines.append(f'  {"SYSCALL":<22s} {"COUNT":>10s} {"AVG_OVERHEAD(us/call)":>22s}')
+        heaviest = sorted(s['syscalls'].items(), key=lambda e: e[1]['count'] * e[1]['avg_overhead'], reverse=True)
+        for k, v in heaviest[:5]:
+            lines.append(f'  {k:<22s} {v["count"]:>10d} {v["avg_overhead"]:>22.3f}')
+    return '\n'.join(lines)
+
+def parse_args():
+    parser = argparse.ArgumentParser(description='Measure bpfbench slowdown and accuracy on a set of workloads.')
+    parser.add_argument('workloads', metavar='workload', nargs='*', default=list(WORKLOADS),
+            help=f'Workloads to run, out of {", ".join(WORKLOADS)}. Defaults to all.')
+    parser.add_argument('--runs', metavar='N', type=int, default=3,
+            help='Runs with and without bpfbench per workload, medians are reported. Defaults to 3.')
+    parser.add_argument('--bpfbench-args', metavar='args', type=shlex.split, default=[],
+            help='Extra bpfbench options to measure, like "--hist --offcpu".')
+    parser.add_argument('--save', metavar='file', type=str,
+            help='Save the results as JSON, to be used with --baseline later.')
+    parser.add_argument('--baseline', metavar='file', type=str,
+            help='Show the slowdown of an earlier --save next to this run.')
+    parser.add_argument('--cpu', metavar='cpu', type=int,
+            help='Pin bpfbench and the workloads to this CPU to reduce noise.')
+    args = parser.parse_args()
+    if any(name not in WORKLOADS for name in args.workloads):
+        parser.error(f'Workloads must be in {", ".join(WORKLOADS)}.')
+    if args.runs <= 0:
+        parser.error('--runs must be positive.')
+    for name in args.workloads:
+        if not os.access(os.path.join(BUILD, name), os.X_OK):
+            parser.error(f'{name} not found in {BUILD}, run make benchmarks first.')
+    if os.geteuid() != 0:
+        parser.error('This script must be run with root privileges.')
+    return args
+
+def main():
+    args = parse_args()
+    if args.cpu is not None:
+        os.sched_setaffinity(0, {args.cpu})
+    baseline = None
+    if args.baseline:
+        with open(args.baseline, 'r') as f:
+            baseline = json.load(f)
+
+    # bpfbench writes its outfile as the invoking user
+    with tempfile.TemporaryDirectory(prefix='bpfbench-suite-') as outdir:
+        if os.getenv('SUDO_UID'):
+            os.chown(outdir, int(os.environ['SUDO_UID']), int(os.environ['SUDO_GID']))
+
+        summaries = {}
+        for name in args.workloads:
+            print(f'Running {name}...', file=sys.stderr)
+            summaries[name] = summarize(name, *measure(name, args, outdir))
+    print(format_summary(summaries, baseline))
+
+    if args.save:
+        with open(args.save, 'w') as f:
+            json.dump({
+                'kernel': platform.release(),
+                'machine': platform.machine(),
+                'bpfbench_args': args.bpfbench_args,
+                'runs': args.runs,
+                'workloads': summaries,
+            }, f, indent=2)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,56 @@
+/* bpfbench  A better benchmarking tool written in eBPF.
+ * Copyright (C) 2020  William Findlay
+ *
+ * Heavily inspired by syscount from bcc-tools:
+ * https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+/* Shared by the benchmark workloads: every workload does <ops> operations
+ * and reports its own time per operation on stdout, which suite.py and
+ * probe_cost.py parse. */
+
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static inline long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Parse the optional [ops] argument, exit on anything else */
+static inline long parse_ops(int argc, char **argv, long default_ops)
+{
+    long ops = argc > 1 ? strtol(argv[1], NULL, 10) : default_ops;
+
+    if (ops <= 0) {
+        fprintf(stderr, "usage: %s [ops]\n", argv[0]);
+        exit(1);
+    }
+    return ops;
+}
+
+static inline void report(long ops, long long elapsed)
+{
+    printf("ops %ld ns/op %.3f\n", ops, (double)elapsed / ops);
+}
+
+#endif /* WORKLOAD_H */
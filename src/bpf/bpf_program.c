@@ -19,70 +19,889 @@
 
 #include <linux/sched.h>
 #include <linux/signal.h>
-#include <uapi/asm/unistd_64.h>
+#ifdef IO
+#include <linux/fs.h>
+#include <linux/fdtable.h>
+#endif
+#ifdef FAULTS
+#include <linux/mm.h>
+#endif
+#ifdef FUTEX
+#include <linux/futex.h>
+#ifndef FUTEX_LOCK_PI2
+#define FUTEX_LOCK_PI2 13 /* Linux 5.14 */
+#endif
+#endif
+#include <uapi/asm/unistd.h>
+
+/* Clock of every timestamp, chosen with --clock */
+#if defined(CLOCK_BOOT)
+#define clock_ns() bpf_ktime_get_boot_ns()   /* counts suspend, Linux 5.8 */
+#elif defined(CLOCK_COARSE)
+#define clock_ns() bpf_ktime_get_coarse_ns() /* tick resolution, Linux 5.11 */
+#elif defined(CLOCK_TAI)
+#define clock_ns() bpf_ktime_get_tai_ns()    /* Linux 6.1 */
+#else
+#define clock_ns() bpf_ktime_get_ns()
+#endif
+
+/* Indices into the stats map, keep in sync with src/defs.py */
+#define STAT_UNMATCHED_ENTER 0 /* sys_enter while a call was still in flight */
+#define STAT_UNMATCHED_EXIT  1 /* sys_exit without a matching sys_enter */
+#define STAT_TRACKING_FULL   2 /* intermediate map was full at sys_enter */
+#define STAT_STREAM_DROPPED  3 /* events ring buffer was full */
+#define STAT_STACKS_LOST     4 /* stack or stacks map was full */
+#define NUM_STATS            5
+
+/* Values in the targets map, keep in sync with src/defs.py */
+#define TARGET_ROOT  1 /* added by the user */
+#define TARGET_CHILD 2 /* followed descendant of a root */
+#define TARGET_MATCH 3 /* matched by --comm or --cgroup */
+
+/* File descriptor types of I/O calls, keep in sync with src/defs.py */
+#define FD_FILE      0
+#define FD_SOCKET    1
+#define FD_PIPE      2
+#define FD_OTHER     3 /* devices, anonymous inodes, bad fds */
+#define NUM_FD_TYPES 4
+
+/* Kinds of user page faults, keep in sync with src/defs.py */
+#define FAULT_MINOR     0
+#define FAULT_MAJOR     1 /* needed I/O */
+#define NUM_FAULT_TYPES 2
+
+/* io_uring opcodes with their own slot, keep in sync with src/defs.py */
+#define NUM_URING_OPS 64
+
+/* Why a trigger fired, keep in sync with src/defs.py */
+#define TRIGGER_LATENCY_HIT 1 /* a call took at least TRIGGER_LATENCY ns */
+#define TRIGGER_RATE_HIT    2 /* a syscall made TRIGGER_RATE calls within a second */
+
+/* Sampled calls shorter than this square into ns^2 without overflow worries */
+#define SAMPLE_SQ_NS_MAX (1ULL << 16)
+
+/* Errno values with their own slot, keep in sync with src/defs.py */
+#define NUM_ERRNO_SLOTS 16 /* the last slot holds every other errno */
+#define MAX_ERRNO       4095
 
 /* structs below this line -------------------------------------------------- */
 
 struct intermediate_t {
-    u64 pid_tgid;
     u64 start_time;
+    u32 sysnum;       /* saved here, sys_exit has no portable way to get it */
+#ifdef OFFCPU
+    u64 offcpu_start; /* switched out at, while in a syscall */
+    u64 offcpu;       /* total time switched out during this call */
+#endif
+#ifdef KERNEL_STACKS
+    s32 kernel_stack; /* where this call first blocked, or negative */
+#endif
+#ifdef IO
+    u32 fd_type;      /* type of the fd in the first argument */
+#endif
+#ifdef SAMPLING
+    u32 weight;       /* calls this sampled call stands for */
+#endif
+#ifdef RUNQ
+    u64 runq_start;   /* woken or preempted at, while in a syscall */
+#endif
+#ifdef FUTEX
+    u64 futex_uaddr;  /* arguments of futex calls, the rest are zero */
+    u32 futex_op;
+#endif
+#ifdef NGRAM
+    /* History of this thread, kept across calls, oldest first */
+    u32 ngram_prev[NGRAM - 1];
+    u64 ngram_delta[NGRAM - 1]; /* latencies of those calls */
+    u32 ngram_len;              /* how many of them are valid */
+#endif
 };
 
 struct data_t {
     u64 count;
     u64 overhead;
+    u64 max;
+#ifdef OFFCPU
+    u64 offcpu;
+#endif
+#ifdef ERRORS
+    u64 err_count;    /* calls that returned an errno */
+    u64 err_overhead; /* time spent in those calls */
+#endif
+#ifdef SAMPLING
+    u64 samples;      /* calls actually timed, count and overhead are scaled */
+    u64 sample_sq;    /* sum of squared latencies of timed calls, in us^2 */
+    u64 sample_sq_ns; /* the same for calls under SAMPLE_SQ_NS_MAX, in ns^2 */
+#endif
+};
+
+#ifdef IO
+struct io_t {
+    u64 count;
+    u64 overhead;
+    u64 bytes; /* sum of positive return values */
 };
+#endif
+
+#ifdef FAULTS
+/* A user page fault in handle_mm_fault, possibly across retries */
+struct fault_t {
+    u64 start_time;
+    u32 major; /* an earlier try already did I/O */
+};
+#endif
+
+#ifdef URING
+/* The kernel's request if the tracepoints have it, otherwise the ring and
+ * user_data, which the application should keep unique while in flight */
+struct uring_key_t {
+    u64 id;
+    u64 user_data;
+};
+
+#ifdef URING_NO_REQ
+#define uring_key(args) ((struct uring_key_t){ (u64)args->ctx, args->user_data })
+#else
+#define uring_key(args) ((struct uring_key_t){ (u64)args->req, 0 })
+#endif
+
+/* An SQE between submission and completion */
+struct uring_t {
+    u64 start_time;
+    u32 opcode;
+    u32 __pad;
+};
+#endif
+
+#ifdef FUTEX
+struct futex_key_t {
+    u64 uaddr; /* only unique within a process */
+    u32 tgid;
+    u32 __pad;
+};
+
+struct futex_t {
+    struct data_t wait;
+#ifdef FUTEX_STACKS
+    s32 user_stack; /* of the slowest wait on this CPU */
+    u32 __pad;
+#endif
+};
+#endif
+
+#ifdef NGRAM
+struct ngram_key_t {
+    u32 sysnum[NGRAM]; /* oldest first */
+};
+#endif
+
+#ifdef DYNAMIC_FILTER
+/* Filter configuration, updated from user space while running */
+struct config_t {
+    u32 self_pid; /* bpfbench itself, never traced */
+    u8 filter;    /* only trace pids in targets */
+    u8 follow;    /* add descendants of targets */
+};
+#endif
+
+#ifdef FILTER_COMM
+struct comm_t {
+    char comm[TASK_COMM_LEN];
+};
+#endif
+
+#if defined(STREAM) || defined(TRIGGER)
+/* Fixed-size per-event record, keep in sync with src/stream.py */
+struct event_t {
+    u32 tid;
+    u32 sysnum;
+    u64 start_time;
+    u64 duration;
+    s64 ret;
+};
+#endif
+
+#ifdef TRIGGER
+/* Sent to user space when a trigger fires */
+struct trigger_t {
+    u64 time;  /* clock_ns() at the end of the call that fired */
+    u64 value; /* latency in ns, or calls in the current second */
+    u32 reason;
+    u32 sysnum;
+};
+
+#ifdef TRIGGER_RATE
+/* Calls of one syscall in the current one-second window, on all CPUs */
+struct rate_t {
+    u64 window_start;
+    u64 count;
+    u64 fired; /* a trigger already fired in this window */
+};
+#endif
+#endif
+
+#ifdef BREAKDOWN
+struct breakdown_key_t {
+    u64 id; /* tgid, or cgroup id with BREAKDOWN_CGROUP */
+    u32 sysnum;
+    u32 __pad;
+};
+#endif
+
+#ifdef STACKS
+struct stack_key_t {
+    u32 tgid;
+    u32 sysnum;
+    s32 user_stack;
+    s32 kernel_stack;
+};
+#endif
 
 /* maps below this line ----------------------------------------------------- */
 
-BPF_PERCPU_ARRAY(intermediate, struct intermediate_t, 1);
+/* Keyed by thread id, so that calls which block and migrate stay matched */
+BPF_HASH(intermediate, u32, struct intermediate_t, MAX_THREADS);
 BPF_PERCPU_ARRAY(syscalls, struct data_t, NUM_SYSCALLS);
-#ifdef FOLLOW
+BPF_PERCPU_ARRAY(stats, u64, NUM_STATS);
+#if defined(HISTOGRAM) || defined(RUNQ)
+/* Log2 latency buckets, each split into HIST_SUB_BUCKETS linear sub-buckets */
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (HIST_SLOTS * HIST_SUB_BUCKETS)
+#endif
+#ifdef HISTOGRAM
+BPF_PERCPU_ARRAY(hists, u64, NUM_SYSCALLS * HIST_BUCKETS);
+#endif
+#ifdef RUNQ
+/* Wakeup-to-run latency, per wait, of threads inside each system call */
+BPF_PERCPU_ARRAY(runq, struct data_t, NUM_SYSCALLS);
+BPF_PERCPU_ARRAY(runq_hists, u64, NUM_SYSCALLS * HIST_BUCKETS);
+#endif
+#ifdef SAMPLING
+/* Time one in N calls on each CPU, N is adjusted from user space */
+BPF_ARRAY(sample_rate, u32, 1);
+BPF_PERCPU_ARRAY(sample_countdown, u32, 1);
+#endif
+#ifdef ERRORS
+BPF_PERCPU_ARRAY(errnos, u64, NUM_SYSCALLS * NUM_ERRNO_SLOTS);
+#endif
+#ifdef IO
+BPF_PERCPU_ARRAY(io, struct io_t, NUM_SYSCALLS * NUM_FD_TYPES);
+#endif
+#ifdef FAULTS
+BPF_HASH(fault_start, u32, struct fault_t, MAX_THREADS);
+BPF_PERCPU_ARRAY(faults, struct data_t, NUM_FAULT_TYPES);
+#ifdef HISTOGRAM
+BPF_PERCPU_ARRAY(fault_hists, u64, NUM_FAULT_TYPES * HIST_BUCKETS);
+#endif
+#endif
+#ifdef URING
+BPF_TABLE("lru_hash", struct uring_key_t, struct uring_t, uring_start, URING_SIZE);
+BPF_PERCPU_ARRAY(uring, struct data_t, NUM_URING_OPS);
+#ifdef HISTOGRAM
+BPF_PERCPU_ARRAY(uring_hists, u64, NUM_URING_OPS * HIST_BUCKETS);
+#endif
+#endif
+#ifdef DYNAMIC_FILTER
+BPF_ARRAY(config, struct config_t, 1);
+BPF_HASH(targets, u32, u8, MAX_TARGETS);
+#ifdef FILTER_COMM
+BPF_HASH(comms, struct comm_t, u8, NUM_COMMS);
+#endif
+#ifdef FILTER_CGROUP
+BPF_CGROUP_ARRAY(cgroups, NUM_CGROUPS);
+#endif
+#elif defined(FOLLOW)
 BPF_HASH(children, u32, u8);
 #endif
 
+#ifdef BREAKDOWN
+/* LRU keeps the map bounded no matter how many processes come and go */
+BPF_TABLE("lru_percpu_hash", struct breakdown_key_t, struct data_t, breakdown, BREAKDOWN_SIZE);
+#endif
+
+#ifdef STREAM
+BPF_RINGBUF_OUTPUT(events, STREAM_PAGES);
+#endif
+
+#ifdef TRIGGER
+/* The last TRIGGER_EVENTS calls of each CPU, overwritten in a circle */
+BPF_PERCPU_ARRAY(recent, struct event_t, TRIGGER_EVENTS);
+BPF_PERCPU_ARRAY(recent_head, u32, 1);
+BPF_ARRAY(trigger_last, u64, 1);
+BPF_RINGBUF_OUTPUT(triggers, 1);
+#ifdef TRIGGER_RATE
+BPF_ARRAY(rates, struct rate_t, NUM_SYSCALLS);
+#endif
+#endif
+
+#if defined(STACKS) || defined(FUTEX_STACKS)
+BPF_STACK_TRACE(stack_traces, STACKS_SIZE);
+#endif
+#ifdef STACKS
+BPF_HASH(stacks, struct stack_key_t, struct data_t, STACKS_SIZE);
+#endif
+
+#ifdef NGRAM
+/* Consecutive calls of a thread, with their summed latency */
+BPF_TABLE("lru_percpu_hash", struct ngram_key_t, struct data_t, ngrams, NGRAMS_SIZE);
+#endif
+
+#ifdef FUTEX
+/* Wait time per lock word, bounded like the breakdown map */
+BPF_TABLE("lru_percpu_hash", struct futex_key_t, struct futex_t, futexes, FUTEX_SIZE);
+#endif
+
 /* helpers below this line -------------------------------------------------- */
 
-static inline int do_sysenter(long syscall)
+static inline void stat_increment(int stat)
 {
-    u64 curr_time = bpf_ktime_get_ns();
-    u64 pid_tgid = bpf_get_current_pid_tgid();
+    u64 *val = stats.lookup(&stat);
+    if (val) {
+        (*val)++;
+    }
+}
 
-/* Maybe filter by PID */
-#if defined(TRACE_PID) && defined(FOLLOW)
+#if defined(FILTER_COMM) || defined(FILTER_CGROUP)
+/* Return nonzero if the current task matches --comm or --cgroup */
+static inline int matches_target()
+{
+#ifdef FILTER_CGROUP
+#pragma unroll
+    for (int i = 0; i < NUM_CGROUPS; i++) {
+        if (cgroups.check_current_task(i) == 1) {
+            return 1;
+        }
+    }
+#endif
+
+#ifdef FILTER_COMM
+    struct comm_t comm = {};
+    bpf_get_current_comm(&comm.comm, sizeof(comm.comm));
+    if (comms.lookup(&comm)) {
+        return 1;
+    }
+#endif
+
+    return 0;
+}
+#endif
+
+/* Return nonzero if events from <pid_tgid> should be ignored */
+static inline int filtered(u64 pid_tgid)
+{
     u32 pid = (pid_tgid >> 32);
-    if (pid != TRACE_PID && !children.lookup(&pid)) {
+
+#ifdef DYNAMIC_FILTER
+    int zero = 0;
+    struct config_t *cfg = config.lookup(&zero);
+    if (!cfg || pid == cfg->self_pid) {
+        return 1;
+    }
+    if (!cfg->filter || targets.lookup(&pid)) {
         return 0;
     }
-#elif defined(TRACE_PID)
-    if (pid_tgid >> 32 != TRACE_PID) {
+
+#if defined(FILTER_COMM) || defined(FILTER_CGROUP)
+    /* Matching processes are added to targets, so they only pay this once */
+    if (matches_target()) {
+        u8 match = TARGET_MATCH;
+        targets.update(&pid, &match);
         return 0;
     }
 #endif
 
+    return 1;
+#else
+/* Maybe filter by PID, compiled in so this costs a single comparison */
+#if defined(TRACE_PID) && defined(FOLLOW)
+    if (pid != TRACE_PID && !children.lookup(&pid)) {
+        return 1;
+    }
+#elif defined(TRACE_PID)
+    if (pid != TRACE_PID) {
+        return 1;
+    }
+#endif
+
     /* Don't trace self */
-    if (pid_tgid >> 32 == BPFBENCH_PID) {
+    return pid == BPFBENCH_PID;
+#endif
+}
+
+/* Account a call of <delta> ns standing for <weight> calls */
+static inline void account(struct data_t *data, u64 delta, u64 weight)
+{
+    data->count += weight;
+    data->overhead += delta * weight;
+    if (delta > data->max) {
+        data->max = delta;
+    }
+#ifdef SAMPLING
+    /* Whole us would square sub-us calls to 0, short calls keep their ns */
+    data->samples++;
+    if (delta < SAMPLE_SQ_NS_MAX) {
+        data->sample_sq_ns += delta * delta;
+    } else {
+        u64 delta_us = delta / 1000;
+        data->sample_sq += delta_us * delta_us;
+    }
+#endif
+}
+
+#ifdef SAMPLING
+/* Return the weight of a call to time, or 0 to skip it */
+static inline u32 sample()
+{
+    int zero = 0;
+    u32 *rate = sample_rate.lookup(&zero);
+    u32 *countdown = sample_countdown.lookup(&zero);
+    if (!rate || !countdown) {
+        return 0;
+    }
+    /* Not set by user space yet, don't wrap the countdown */
+    if (!*rate) {
         return 0;
     }
+    /* A lower rate takes effect right away */
+    if (*countdown >= *rate) {
+        *countdown = *rate - 1;
+    }
+    if (*countdown > 0) {
+        (*countdown)--;
+        return 0;
+    }
+    *countdown = *rate - 1;
+    return *rate;
+}
+#endif
+
+#if defined(HISTOGRAM) || defined(RUNQ)
+/* Map a latency in ns to its bucket, mirrored by src/histogram.py */
+static inline u32 hist_index(u64 value)
+{
+    /* floor(log2(value)) + 1, with zero sharing slot 1 */
+    u32 slot = bpf_log2l(value);
+    u32 sub = 0;
+
+#if HIST_SUB_BITS > 0
+    if (slot > HIST_SUB_BITS) {
+        sub = (value >> (slot - 1 - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1);
+    }
+#endif
+
+    /* Clamp outliers into the last bucket */
+    if (slot >= HIST_SLOTS) {
+        slot = HIST_SLOTS - 1;
+        sub = HIST_SUB_BUCKETS - 1;
+    }
+
+    return slot * HIST_SUB_BUCKETS + sub;
+}
+#endif
+
+#ifdef ERRORS
+/* Map a positive errno to its slot in the errnos map */
+static inline u32 errno_slot(long err)
+{
+    switch (err) {
+    case EPERM:       return 0;
+    case ENOENT:      return 1;
+    case EINTR:       return 2;
+    case EBADF:       return 3;
+    case ECHILD:      return 4;
+    case EAGAIN:      return 5;
+    case ENOMEM:      return 6;
+    case EACCES:      return 7;
+    case EEXIST:      return 8;
+    case EINVAL:      return 9;
+    case ENOTTY:      return 10;
+    case EPIPE:       return 11;
+    case ECONNRESET:  return 12;
+    case ETIMEDOUT:   return 13;
+    case EINPROGRESS: return 14;
+    default:          return NUM_ERRNO_SLOTS - 1;
+    }
+}
+#endif
+
+#ifdef IO
+/* Classify the file behind <fd> in the current task's fd table */
+static inline u32 fd_type(unsigned long fd)
+{
+    struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+    struct fdtable *fdt = task->files->fdt;
+    if (fd >= fdt->max_fds) {
+        return FD_OTHER;
+    }
+
+    struct file **fds = fdt->fd;
+    struct file *file = NULL;
+    bpf_probe_read_kernel(&file, sizeof(file), &fds[fd]);
+    if (!file) {
+        return FD_OTHER;
+    }
 
+    umode_t mode = file->f_inode->i_mode;
+    if (S_ISREG(mode)) {
+        return FD_FILE;
+    }
+    if (S_ISSOCK(mode)) {
+        return FD_SOCKET;
+    }
+    if (S_ISFIFO(mode)) {
+        return FD_PIPE;
+    }
+    return FD_OTHER;
+}
+#endif
+
+#ifdef STREAM
+static inline void stream_event(u64 pid_tgid, long syscall, u64 start_time,
+                                u64 delta, long ret)
+{
+#if STREAM_MIN_DURATION > 0
+    /* Only slow calls go out */
+    if (delta < STREAM_MIN_DURATION) {
+        return;
+    }
+#endif
+
+#if STREAM_SAMPLE > 1
+    if (bpf_get_prandom_u32() % STREAM_SAMPLE) {
+        return;
+    }
+#endif
+
+    struct event_t *event = events.ringbuf_reserve(sizeof(struct event_t));
+    if (!event) {
+        stat_increment(STAT_STREAM_DROPPED);
+        return;
+    }
+    event->tid = pid_tgid;
+    event->sysnum = syscall;
+    event->start_time = start_time;
+    event->duration = delta;
+    event->ret = ret;
+    events.ringbuf_submit(event, 0);
+}
+#endif
+
+#ifdef STACKS
+/* Attribute a slow call to its call site, only paid above the threshold */
+static inline void stack_account(void *ctx, u64 pid_tgid, long syscall,
+                                 struct intermediate_t *start, u64 delta,
+                                 u64 weight)
+{
+    if (delta < STACKS_THRESHOLD) {
+        return;
+    }
+
+    struct stack_key_t key = {};
+    key.tgid = pid_tgid >> 32;
+    key.sysnum = syscall;
+    key.user_stack = stack_traces.get_stackid(ctx, BPF_F_USER_STACK);
+#ifdef KERNEL_STACKS
+    key.kernel_stack = start->kernel_stack;
+#else
+    key.kernel_stack = -1;
+#endif
+
+    struct data_t zero = {};
+    struct data_t *data = stacks.lookup_or_try_init(&key, &zero);
+    /* Colliding stack ids are not replaced, they would rewrite older keys */
+    if (!data || key.user_stack == -EEXIST) {
+        stat_increment(STAT_STACKS_LOST);
+    }
+    if (data) {
+        account(data, delta, weight);
+    }
+}
+#endif
+
+#ifdef FUTEX
+/* Whether a futex op blocks until the lock word is woken or released */
+static inline int futex_waits(u32 op)
+{
+    switch (op & FUTEX_CMD_MASK) {
+    case FUTEX_WAIT:
+    case FUTEX_WAIT_BITSET:
+    case FUTEX_WAIT_REQUEUE_PI:
+    case FUTEX_LOCK_PI:
+    case FUTEX_LOCK_PI2:
+        return 1;
+    }
+    return 0;
+}
+
+/* Charge a futex wait to its (process, lock word) */
+static inline void futex_account(void *ctx, u64 pid_tgid,
+                                 struct intermediate_t *start, u64 delta,
+                                 u64 weight)
+{
+    struct futex_key_t key = {};
+    key.uaddr = start->futex_uaddr;
+    key.tgid = pid_tgid >> 32;
+
+    struct futex_t zero = {};
+    struct futex_t *futex = futexes.lookup_or_try_init(&key, &zero);
+    if (!futex) {
+        return;
+    }
+#ifdef FUTEX_STACKS
+    /* Only a new maximum pays for a stack walk */
+    if (delta > futex->wait.max) {
+        futex->user_stack = stack_traces.get_stackid(ctx, BPF_F_USER_STACK);
+        if (futex->user_stack < 0) {
+            stat_increment(STAT_STACKS_LOST);
+        }
+    }
+#endif
+    account(&futex->wait, delta, weight);
+}
+#endif
+
+#ifdef NGRAM
+/* Count the sequence ending with this call, then push it to the history */
+static inline void ngram_account(struct intermediate_t *start, long syscall,
+                                 u64 delta, u64 weight)
+{
+    if (start->ngram_len == NGRAM - 1) {
+        struct ngram_key_t key = {};
+        u64 overhead = delta;
+#pragma unroll
+        for (int i = 0; i < NGRAM - 1; i++) {
+            key.sysnum[i] = start->ngram_prev[i];
+            overhead += start->ngram_delta[i];
+        }
+        key.sysnum[NGRAM - 1] = syscall;
+
+        struct data_t zero = {};
+        struct data_t *data = ngrams.lookup_or_try_init(&key, &zero);
+        if (data) {
+            account(data, overhead, weight);
+        }
+    } else {
+        start->ngram_len++;
+    }
+
+#pragma unroll
+    for (int i = 0; i < NGRAM - 2; i++) {
+        start->ngram_prev[i] = start->ngram_prev[i + 1];
+        start->ngram_delta[i] = start->ngram_delta[i + 1];
+    }
+    start->ngram_prev[NGRAM - 2] = syscall;
+    start->ngram_delta[NGRAM - 2] = delta;
+}
+#endif
+
+#ifdef TRIGGER
+/* Keep this call in the CPU's circular buffer of recent calls */
+static inline void trigger_record(u64 pid_tgid, long syscall, u64 start_time,
+                                  u64 delta, long ret)
+{
     int zero = 0;
-    struct intermediate_t *start = intermediate.lookup(&zero);
-    if (!start) {
+    u32 *head = recent_head.lookup(&zero);
+    if (!head) {
+        return;
+    }
+    int index = *head;
+    *head = (index + 1) % TRIGGER_EVENTS;
+
+    struct event_t *event = recent.lookup(&index);
+    if (!event) {
+        return;
+    }
+    event->tid = pid_tgid;
+    event->sysnum = syscall;
+    event->start_time = start_time;
+    event->duration = delta;
+    event->ret = ret;
+}
+
+/* Wake up user space, at most once per TRIGGER_HOLDOFF ns */
+static inline void trigger_fire(u32 reason, long syscall, u64 value,
+                                u64 curr_time)
+{
+    int zero = 0;
+    u64 *last = trigger_last.lookup(&zero);
+    if (!last || (*last && curr_time - *last < TRIGGER_HOLDOFF)) {
+        return;
+    }
+    *last = curr_time;
+
+    struct trigger_t trigger = {};
+    trigger.time = curr_time;
+    trigger.value = value;
+    trigger.reason = reason;
+    trigger.sysnum = syscall;
+    triggers.ringbuf_output(&trigger, sizeof(trigger), 0);
+}
+
+static inline void trigger_check(long syscall, u64 delta, u64 curr_time,
+                                 u64 weight)
+{
+#ifdef TRIGGER_LATENCY
+    if (delta >= TRIGGER_LATENCY) {
+        trigger_fire(TRIGGER_LATENCY_HIT, syscall, delta, curr_time);
+    }
+#endif
+
+#ifdef TRIGGER_RATE
+    struct rate_t *rate = rates.lookup((int *)&syscall);
+    if (!rate) {
+        return;
+    }
+    /* CPUs may race to start a window, which only blurs its boundary */
+    if (curr_time - rate->window_start >= 1000000000ULL) {
+        rate->window_start = curr_time;
+        rate->count = 0;
+        rate->fired = 0;
+    }
+    lock_xadd(&rate->count, weight);
+    if (!rate->fired && rate->count >= TRIGGER_RATE) {
+        rate->fired = 1;
+        trigger_fire(TRIGGER_RATE_HIT, syscall, rate->count, curr_time);
+    }
+#endif
+}
+#endif
+
+static inline int do_sysenter(struct pt_regs *regs, long syscall)
+{
+#ifdef SYSCALL_ALLOWED
+    /* Return before touching the clock or any map */
+    if (!SYSCALL_ALLOWED(syscall)) {
+        return 0;
+    }
+#endif
+
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    if (filtered(pid_tgid)) {
         return 0;
     }
 
-    /* Record pit_tgid of initiating process,
-     * we use this for error checking later */
-    start->pid_tgid = pid_tgid;
-    /* Record start time */
-    start->start_time = curr_time;
+#ifdef SAMPLING
+    /* Skipped calls leave no start time, so their sys_exit is ignored */
+    u32 weight = sample();
+    if (!weight) {
+        return 0;
+    }
+#endif
+
+#ifdef FUTEX
+    /* Which lock word is waited on is only known from the arguments */
+    unsigned long futex_uaddr = 0;
+    unsigned long futex_op = 0;
+    if (syscall == __NR_futex) {
+        bpf_probe_read_kernel(&futex_uaddr, sizeof(futex_uaddr), &PT_REGS_PARM1(regs));
+        bpf_probe_read_kernel(&futex_op, sizeof(futex_op), &PT_REGS_PARM2(regs));
+    }
+#endif
+
+#ifdef IO
+    /* The fd is looked up now, it may be closed or reused by sys_exit */
+    u32 type = FD_OTHER;
+    if (IO_ALLOWED(syscall)) {
+        unsigned long fd = 0;
+        bpf_probe_read_kernel(&fd, sizeof(fd), &PT_REGS_PARM1(regs));
+        type = fd_type(fd);
+    }
+#endif
+
+    u32 tid = pid_tgid;
+    struct intermediate_t *start = intermediate.lookup(&tid);
+    if (start) {
+        /* The previous call never returned (e.g. exit or a lost sys_exit) */
+        if (start->start_time) {
+            stat_increment(STAT_UNMATCHED_ENTER);
+        }
+#ifdef OFFCPU
+        start->offcpu_start = 0;
+        start->offcpu = 0;
+#endif
+#ifdef KERNEL_STACKS
+        start->kernel_stack = -1;
+#endif
+#ifdef RUNQ
+        start->runq_start = 0;
+#endif
+#ifdef IO
+        start->fd_type = type;
+#endif
+#ifdef SAMPLING
+        start->weight = weight;
+#endif
+#ifdef FUTEX
+        start->futex_uaddr = futex_uaddr;
+        start->futex_op = futex_op;
+#endif
+        /* Record start time */
+        start->sysnum = syscall;
+        start->start_time = clock_ns();
+        return 0;
+    }
+
+    /* First system call for this thread */
+    struct intermediate_t new_start = {};
+    new_start.sysnum = syscall;
+    new_start.start_time = clock_ns();
+#ifdef KERNEL_STACKS
+    new_start.kernel_stack = -1;
+#endif
+#ifdef IO
+    new_start.fd_type = type;
+#endif
+#ifdef SAMPLING
+    new_start.weight = weight;
+#endif
+#ifdef FUTEX
+    new_start.futex_uaddr = futex_uaddr;
+    new_start.futex_op = futex_op;
+#endif
+    if (intermediate.update(&tid, &new_start)) {
+        stat_increment(STAT_TRACKING_FULL);
+    }
 
     return 0;
 }
 
-static inline int do_sysexit(long syscall, long ret)
+static inline int do_sysexit(void *ctx, long ret)
 {
-    u64 curr_time = bpf_ktime_get_ns();
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+
+    /* Only calls that passed the filters at sys_enter have a start time */
+    u32 tid = pid_tgid;
+    struct intermediate_t *start = intermediate.lookup(&tid);
+    /* We don't want to count twice for calls that return in two places */
+    if (!start || !start->start_time) {
+#if !defined(SAMPLING) && !defined(SYSCALL_ALLOWED)
+        /* Otherwise, this is just as likely a call that was not timed */
+        if (!filtered(pid_tgid)) {
+            stat_increment(STAT_UNMATCHED_EXIT);
+        }
+#endif
+        return 0;
+    }
+    /* Untimed calls, e.g. outside --syscalls, never read the clock */
+    u64 curr_time = clock_ns();
+    long syscall = start->sysnum;
+    u64 start_time = start->start_time;
+    start->start_time = 0;
+#ifdef RUNQ
+    start->runq_start = 0;
+#endif
+#ifdef OFFCPU
+    u64 offcpu = start->offcpu;
+#endif
+#ifdef IO
+    u32 type = start->fd_type;
+#endif
+#ifdef SAMPLING
+    u64 weight = start->weight;
+#else
+    u64 weight = 1;
+#endif
+
     /* Discard restarted syscalls due to system suspend */
     if (syscall == __NR_restart_syscall) {
         return 0;
@@ -94,48 +913,123 @@ static inline int do_sysexit(long syscall, long ret)
         return 0;
     }
 
-    u64 pid_tgid = bpf_get_current_pid_tgid();
+    u64 delta = curr_time - start_time;
 
-/* Maybe filter by PID */
-#if defined(TRACE_PID) && defined(FOLLOW)
-    u32 pid = (pid_tgid >> 32);
-    if (pid != TRACE_PID && !children.lookup(&pid)) {
+    struct data_t *data = syscalls.lookup((int *)&syscall);
+    if (!data) {
         return 0;
     }
-#elif defined(TRACE_PID)
-    if (pid_tgid >> 32 != TRACE_PID) {
-        return 0;
+    account(data, delta, weight);
+#ifdef OFFCPU
+    data->offcpu += offcpu * weight;
+#endif
+
+#ifdef ERRORS
+    /* Failed calls are often not real work, e.g. EAGAIN from a busy loop */
+    if (ret < 0 && ret >= -MAX_ERRNO) {
+        data->err_count += weight;
+        data->err_overhead += delta * weight;
+        int errno_index = syscall * NUM_ERRNO_SLOTS + errno_slot(-ret);
+        u64 *errno_count = errnos.lookup(&errno_index);
+        if (errno_count) {
+            (*errno_count) += weight;
+        }
     }
 #endif
 
-    /* Don't trace self */
-    if (pid_tgid >> 32 == BPFBENCH_PID) {
-        return 0;
+#ifdef IO
+    if (IO_ALLOWED(syscall)) {
+        int io_index = syscall * NUM_FD_TYPES + type;
+        struct io_t *io_data = io.lookup(&io_index);
+        if (io_data) {
+            io_data->count += weight;
+            io_data->overhead += delta * weight;
+            if (ret > 0) {
+                io_data->bytes += ret * weight;
+            }
+        }
     }
+#endif
 
-    int zero = 0;
+#ifdef HISTOGRAM
+    int index = syscall * HIST_BUCKETS + hist_index(delta);
+    u64 *bucket = hists.lookup(&index);
+    if (bucket) {
+        (*bucket) += weight;
+    }
+#endif
 
-    struct data_t *data = syscalls.lookup((int *)&syscall);
-    struct intermediate_t *start = intermediate.lookup(&zero);
-    if (start && data) {
-        /* We don't want to count twice for calls that return in two places */
-        if (pid_tgid != start->pid_tgid) {
-            return 0;
-        }
-        data->count++;
-        data->overhead += curr_time - start->start_time;
+#ifdef BREAKDOWN
+    struct breakdown_key_t key = {};
+#ifdef BREAKDOWN_CGROUP
+    key.id = bpf_get_current_cgroup_id();
+#else
+    key.id = pid_tgid >> 32;
+#endif
+    key.sysnum = syscall;
+    struct data_t zero = {};
+    struct data_t *consumer = breakdown.lookup_or_try_init(&key, &zero);
+    if (consumer) {
+        account(consumer, delta, weight);
     }
-    if (start) {
-        start->pid_tgid = 0;
-        start->start_time = 0;
+#endif
+
+#ifdef STACKS
+    stack_account(ctx, pid_tgid, syscall, start, delta, weight);
+#endif
+
+#ifdef NGRAM
+    ngram_account(start, syscall, delta, weight);
+#endif
+
+#ifdef FUTEX
+    if (syscall == __NR_futex && futex_waits(start->futex_op)) {
+        futex_account(ctx, pid_tgid, start, delta, weight);
     }
+#endif
+
+#ifdef STREAM
+    stream_event(pid_tgid, syscall, start_time, delta, ret);
+#endif
+
+#ifdef TRIGGER
+    trigger_record(pid_tgid, syscall, start_time, delta, ret);
+    trigger_check(syscall, delta, curr_time, weight);
+#endif
 
     return 0;
 }
 
 /* bpf programs below this line --------------------------------------------- */
 
-#ifdef FOLLOW
+#ifdef DYNAMIC_FILTER
+RAW_TRACEPOINT_PROBE(sched_process_fork)
+{
+    struct task_struct *p = (struct task_struct *)ctx->args[0];
+    struct task_struct *c = (struct task_struct *)ctx->args[1];
+
+    int zero = 0;
+    struct config_t *cfg = config.lookup(&zero);
+    if (!cfg || !cfg->follow) {
+        return 0;
+    }
+
+    u32 ppid = p->tgid;
+
+    /* Filter ppid */
+    if (!targets.lookup(&ppid)) {
+        return 0;
+    }
+
+    u32 cpid = c->tgid;
+
+    u8 child = TARGET_CHILD;
+
+    targets.update(&cpid, &child);
+
+    return 0;
+}
+#elif defined(FOLLOW)
 RAW_TRACEPOINT_PROBE(sched_process_fork)
 {
     struct task_struct *p = (struct task_struct *)ctx->args[0];
@@ -156,31 +1050,277 @@ RAW_TRACEPOINT_PROBE(sched_process_fork)
 
     return 0;
 }
+#endif
 
 RAW_TRACEPOINT_PROBE(sched_process_exit)
 {
-    u32 pid = (bpf_get_current_pid_tgid() >> 32);
+    u64 pid_tgid = bpf_get_current_pid_tgid();
 
-    /* Filter ppid */
-    if (pid != TRACE_PID && !children.lookup(&pid)) {
+    /* Release the exiting thread's in-flight slot */
+    u32 tid = pid_tgid;
+    intermediate.delete(&tid);
+#ifdef FAULTS
+    fault_start.delete(&tid);
+#endif
+
+    u32 pid = (pid_tgid >> 32);
+
+    /* Only forget processes once their group leader exits */
+    if (tid != pid) {
         return 0;
     }
 
+#ifdef DYNAMIC_FILTER
+    targets.delete(&pid);
+#elif defined(FOLLOW)
     children.delete(&pid);
+#endif
 
     return 0;
 }
+
+#ifdef RUNQ
+/* A thread woken inside a system call starts waiting for a CPU.
+ * New tasks are not inside a call yet, so sched_wakeup_new is not needed. */
+RAW_TRACEPOINT_PROBE(sched_wakeup)
+{
+    struct task_struct *p = (struct task_struct *)ctx->args[0];
+
+    u32 tid = p->pid;
+    struct intermediate_t *start = intermediate.lookup(&tid);
+    if (start && start->start_time && !start->runq_start) {
+        start->runq_start = clock_ns();
+    }
+
+    return 0;
+}
+
+/* Account one wait on the run queue to the call <start> is in */
+static inline void runq_account(struct intermediate_t *start, u64 curr_time)
+{
+    u64 delta = curr_time - start->runq_start;
+    long syscall = start->sysnum;
+    start->runq_start = 0;
+#ifdef SAMPLING
+    u64 weight = start->weight;
+#else
+    u64 weight = 1;
 #endif
 
-RAW_TRACEPOINT_PROBE(sys_enter)
+    struct data_t *data = runq.lookup((int *)&syscall);
+    if (data) {
+        account(data, delta, weight);
+    }
+
+    int index = syscall * HIST_BUCKETS + hist_index(delta);
+    u64 *bucket = runq_hists.lookup(&index);
+    if (bucket) {
+        (*bucket) += weight;
+    }
+}
+#endif
+
+#if defined(OFFCPU) || defined(KERNEL_STACKS) || defined(RUNQ)
+/* Accumulate time spent switched out while inside a system call,
+ * remember where the call blocked, and time waits on the run queue */
+RAW_TRACEPOINT_PROBE(sched_switch)
 {
-    return do_sysenter(ctx->args[1]);
+    struct task_struct *prev = (struct task_struct *)ctx->args[1];
+
+    u32 prev_tid = prev->pid;
+    struct intermediate_t *start = intermediate.lookup(&prev_tid);
+#if defined(OFFCPU) || defined(RUNQ)
+    u64 curr_time = clock_ns();
+#endif
+#ifdef OFFCPU
+    if (start && start->start_time) {
+        start->offcpu_start = curr_time;
+    }
+#endif
+#ifdef RUNQ
+    /* A preempted thread stays runnable, so it is back on the run queue,
+     * and so is one that gave up its CPU in sched_yield. Otherwise it sleeps,
+     * and a wakeup that raced with it going to sleep while it was still
+     * running must not count. */
+    if (start && start->start_time) {
+        int runnable = ctx->args[0] || start->sysnum == __NR_sched_yield;
+        start->runq_start = runnable ? curr_time : 0;
+    }
+#endif
+#ifdef KERNEL_STACKS
+    /* prev is still current here, so this is its kernel stack */
+    if (start && start->start_time && start->kernel_stack < 0) {
+        start->kernel_stack = stack_traces.get_stackid(ctx, 0);
+    }
+#endif
+
+#if defined(OFFCPU) || defined(RUNQ)
+    struct task_struct *next = (struct task_struct *)ctx->args[2];
+    u32 next_tid = next->pid;
+    start = intermediate.lookup(&next_tid);
+#endif
+#ifdef OFFCPU
+    if (start && start->offcpu_start) {
+        start->offcpu += curr_time - start->offcpu_start;
+        start->offcpu_start = 0;
+    }
+#endif
+#ifdef RUNQ
+    if (start && start->runq_start) {
+        runq_account(start, curr_time);
+    }
+#endif
+
+    return 0;
 }
+#endif
 
-RAW_TRACEPOINT_PROBE(sys_exit)
+#ifdef FAULTS
+/* Time page faults taken in user mode. Faults inside system calls
+ * (e.g. copy_to_user) are already part of the call's latency. */
+int kprobe__handle_mm_fault(struct pt_regs *ctx, struct vm_area_struct *vma,
+                            unsigned long address, unsigned int flags)
+{
+    if (!(flags & FAULT_FLAG_USER)) {
+        return 0;
+    }
+
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    if (filtered(pid_tgid)) {
+        return 0;
+    }
+
+    u32 tid = pid_tgid;
+    struct fault_t fault = {};
+    fault.start_time = clock_ns();
+    /* A retry continues the fault that returned VM_FAULT_RETRY */
+    if (flags & FAULT_FLAG_TRIED) {
+        fault_start.insert(&tid, &fault);
+    } else {
+        fault_start.update(&tid, &fault);
+    }
+
+    return 0;
+}
+
+int kretprobe__handle_mm_fault(struct pt_regs *ctx)
+{
+    u64 curr_time = clock_ns();
+    u32 tid = bpf_get_current_pid_tgid();
+
+    struct fault_t *fault = fault_start.lookup(&tid);
+    if (!fault) {
+        return 0;
+    }
+
+    vm_fault_t ret = PT_REGS_RC(ctx);
+    if (ret & VM_FAULT_MAJOR) {
+        fault->major = 1;
+    }
+    /* The arch fault handler calls us again, keep timing */
+    if (ret & VM_FAULT_RETRY) {
+        return 0;
+    }
+
+    u64 delta = curr_time - fault->start_time;
+    int type = fault->major ? FAULT_MAJOR : FAULT_MINOR;
+    fault_start.delete(&tid);
+
+    struct data_t *data = faults.lookup(&type);
+    if (data) {
+        account(data, delta, 1);
+    }
+
+#ifdef HISTOGRAM
+    int index = type * HIST_BUCKETS + hist_index(delta);
+    u64 *bucket = fault_hists.lookup(&index);
+    if (bucket) {
+        (*bucket) += 1;
+    }
+#endif
+
+    return 0;
+}
+#endif
+
+#ifdef URING
+/* Time io_uring requests from submission to completion. Submission runs
+ * in the submitting task (or its SQPOLL thread), so it is filtered like a
+ * system call; completion may run anywhere. */
+static inline int uring_submit(struct uring_key_t key, u8 opcode)
+{
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    if (filtered(pid_tgid)) {
+        return 0;
+    }
+
+    struct uring_t uring = {};
+    uring.start_time = clock_ns();
+    uring.opcode = opcode;
+    uring_start.update(&key, &uring);
+
+    return 0;
+}
+
+#ifdef URING_SUBMIT_REQ
+/* Linux 6.0 renamed io_uring_submit_sqe */
+TRACEPOINT_PROBE(io_uring, io_uring_submit_req)
+{
+    return uring_submit(uring_key(args), args->opcode);
+}
+#else
+TRACEPOINT_PROBE(io_uring, io_uring_submit_sqe)
+{
+    return uring_submit(uring_key(args), args->opcode);
+}
+#endif
+
+/* Only the first completion of a multishot request is timed */
+TRACEPOINT_PROBE(io_uring, io_uring_complete)
+{
+    u64 curr_time = clock_ns();
+    struct uring_key_t key = uring_key(args);
+
+    struct uring_t *start = uring_start.lookup(&key);
+    if (!start) {
+        return 0;
+    }
+    u64 delta = curr_time - start->start_time;
+    int opcode = start->opcode;
+    uring_start.delete(&key);
+
+    struct data_t *data = uring.lookup(&opcode);
+    if (!data) {
+        return 0;
+    }
+    account(data, delta, 1);
+#ifdef ERRORS
+    if (args->res < 0) {
+        data->err_count++;
+        data->err_overhead += delta;
+    }
+#endif
+
+#ifdef HISTOGRAM
+    int index = opcode * HIST_BUCKETS + hist_index(delta);
+    u64 *bucket = uring_hists.lookup(&index);
+    if (bucket) {
+        (*bucket) += 1;
+    }
+#endif
+
+    return 0;
+}
+#endif
+
+RAW_TRACEPOINT_PROBE(sys_enter)
 {
     struct pt_regs *regs = (struct pt_regs *)ctx->args[0];
-    long id = regs->r8;
 
-    return do_sysexit(id, ctx->args[1]);
+    return do_sysenter(regs, ctx->args[1]);
+}
+
+RAW_TRACEPOINT_PROBE(sys_exit)
+{
+    return do_sysexit(ctx, ctx->args[1]);
 }
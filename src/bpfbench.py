@@ -20,21 +20,72 @@
 import os, sys
 import atexit
 import time
+import random
+import math
 import datetime
 import threading
 import signal
 import functools
+import ctypes as ct
 
-from bcc import BPF, syscall
+from bcc import BPF
 
-from src import defs
-from src.parse_args import parse_args
-from src.utils import syscall_name, drop_privileges, which
+from src import compare, defs, export, histogram, metrics, report, stream, timeseries
+from src.parse_args import parse_args, parse_convert_args, parse_compare_args, parse_merge_args
+from src.snapshot import MapSnapshot
+from src.utils import syscall_name, drop_privileges, which, process_name, cgroup_path
+from src.utils import syscall_filter_macro, syscall_number, num_syscalls, online_cpus, cpu_nodes
+from src.utils import tracepoint_fields
 
 signal.signal(signal.SIGINT, lambda x, y: sys.exit())
 signal.signal(signal.SIGTERM, lambda x, y: sys.exit())
 
 
+# Per-syscall result fields that can be subtracted between snapshots
+ADDITIVE_FIELDS = ['count', 'overhead', 'oncpu', 'offcpu', 'bytes', 'errors', 'err_overhead',
+        'samples', 'sample_sq']
+
+
+def io_rates(result, elapsed):
+    """
+    Add throughput in bytes/s and latency in us/KB to an I/O <result>.
+    """
+    result['throughput'] = result['bytes'] / elapsed
+    result['us_per_kb'] = result['overhead'] / (result['bytes'] / 1024) if result['bytes'] else 0.0
+    return result
+
+
+def sampling_confidence(result):
+    """
+    Add 95% confidence half-widths of a sampled <result>: relative for count
+    (binomial thinning), in us for mean latency (normal approximation).
+    """
+    samples = result['samples']
+    mean = result['avg_overhead']
+    var = max(result['sample_sq'] / samples - mean * mean, 0.0) if samples else 0.0
+    result['count_ci'] = 1.96 * math.sqrt(max(1 - samples / result['count'], 0.0) / samples) if samples else 1.0
+    result['avg_ci'] = 1.96 * math.sqrt(var / samples) if samples else 0.0
+    return result
+
+
+def sample_sq(snapshot, i):
+    """
+    Sum of squared latencies in us^2 of slot <i>, which the kernel keeps
+    in ns^2 for short calls and in us^2 for the rest.
+    """
+    return snapshot.sum(i, 'sample_sq') + snapshot.sum(i, 'sample_sq_ns') / 1e6
+
+
+def error_split(result):
+    """
+    Split the count and latency of a <result> into successful and failed calls.
+    """
+    ok_count = result['count'] - result['errors']
+    result['avg_ok'] = (result['overhead'] - result['err_overhead']) / ok_count if ok_count else 0.0
+    result['avg_err'] = result['err_overhead'] / result['errors'] if result['errors'] else 0.0
+    return result
+
+
 class BPFBench:
     """
     Uses a BPF program to benchmark system state.
@@ -58,13 +109,39 @@ class BPFBench:
         )
         # Set should_exit to 0
         self.should_exit = 0
-        # Set trace_pid to 0 for now
+        # Set trace_pid to 0 for now, it becomes the pid of -r
         self.trace_pid = 0
-        # Should sort be reversed?
-        if self.args.sort in ['count', 'overhead', 'avg_overhead']:
-            self.reverse_sort = 1
-        else:
-            self.reverse_sort = 0
+        # Root pids to trace, from -r and -p
+        self.trace_pids = []
+        # Runtime filter state, with --dynamic
+        self.filter_enabled = False
+        self.follow = False
+        self.control_thread = threading.Thread(target=self.control)
+        self.control_thread.setDaemon(1)
+        # Map snapshots and the previous interval, for delta reporting
+        self.snapshots = {}
+        self.prev_results = {}
+        self.last_interval = time.monotonic()
+        # Time-series outfile
+        self.timeseries = None
+        # Metrics server, and a lock for the snapshot buffers it shares with save_results
+        self.metrics_server = None
+        self.results_lock = threading.Lock()
+        # (wall time, results) of each measured --repeat iteration
+        self.iterations = []
+        # Current 1-in-N sampling rate and the controller's last probe run time
+        self.sample_rate = self.args.sample
+        self.last_adapt = None
+        # Previous bpf_stats_enabled and when we turned it on, with --self-stats
+        self.bpf_stats_enabled = None
+        self.self_stats_start = None
+        # Stream thread stuff, also used to receive triggers
+        self.stream_writer = None
+        self.stream_lock = threading.Lock()
+        self.stream_thread = threading.Thread(target=self.drain_ring_buffers)
+        self.stream_thread.setDaemon(1)
+        # Number of triggers received so far, with --trigger-*
+        self.triggers = 0
         # Timer thread stuff
         self.timer_thread = threading.Thread(target=self.timer)
         self.timer_thread.setDaemon(1)
@@ -78,106 +155,978 @@ class BPFBench:
         flags = []
         # Add BPF_PATH for header includes
         flags.append(f'-I{defs.BPF_PATH}')
-        flags.append(f'-DNUM_SYSCALLS={len(syscall.syscalls)}')
+        flags.append(f'-DNUM_SYSCALLS={num_syscalls()}')
         flags.append(f'-DBPFBENCH_PID={os.getpid()}')
-        if self.trace_pid > 0:
-            flags.append(f'-DTRACE_PID={self.trace_pid}')
+        flags.append(f'-DMAX_THREADS={self.args.max_threads}')
+        if self.args.dynamic:
+            flags.append(f'-DDYNAMIC_FILTER')
+            flags.append(f'-DMAX_TARGETS={self.args.max_targets}')
+            if self.args.comm:
+                flags.append(f'-DFILTER_COMM')
+                flags.append(f'-DNUM_COMMS={len(self.args.comm)}')
+            if self.args.cgroup:
+                flags.append(f'-DFILTER_CGROUP')
+                flags.append(f'-DNUM_CGROUPS={len(self.args.cgroup)}')
+        elif self.trace_pids:
+            flags.append(f'-DTRACE_PID={self.trace_pids[0]}')
             if self.args.follow:
                 flags.append(f'-DFOLLOW')
+        if self.args.clock != 'mono':
+            flags.append(f'-DCLOCK_{self.args.clock.upper()}')
+        if self.args.offcpu:
+            flags.append(f'-DOFFCPU')
+        if self.args.sample:
+            flags.append(f'-DSAMPLING')
+        if self.args.errors:
+            flags.append(f'-DERRORS')
+        if self.args.faults:
+            flags.append(f'-DFAULTS')
+        if self.args.io_uring:
+            flags.append(f'-DURING')
+            flags.append(f'-DURING_SIZE={self.args.io_uring_size}')
+            submit = 'io_uring_submit_sqe'
+            if BPF.tracepoint_exists('io_uring', 'io_uring_submit_req'):
+                submit = 'io_uring_submit_req'
+                flags.append(f'-DURING_SUBMIT_REQ')
+            # Linux 5.15 added the request to both tracepoints
+            if not all('req' in tracepoint_fields('io_uring', event)
+                    for event in [submit, 'io_uring_complete']):
+                flags.append(f'-DURING_NO_REQ')
+        if self.args.io:
+            flags.append(f'-DIO')
+            flags.append(f'-D{syscall_filter_macro(self.args.io, "IO_ALLOWED")}')
+        if self.args.syscalls:
+            flags.append(f'-D{syscall_filter_macro(self.args.syscalls)}')
+        if self.args.hist:
+            flags.append(f'-DHISTOGRAM')
+        if self.args.runq:
+            flags.append(f'-DRUNQ')
+        if self.args.hist or self.args.runq:
+            flags.append(f'-DHIST_SLOTS={defs.HIST_SLOTS}')
+            flags.append(f'-DHIST_SUB_BITS={self.args.hist_sub_bits}')
+        if self.args.breakdown:
+            flags.append(f'-DBREAKDOWN')
+            flags.append(f'-DBREAKDOWN_SIZE={self.args.breakdown_size}')
+            if self.args.breakdown == 'cgroup':
+                flags.append(f'-DBREAKDOWN_CGROUP')
+        if self.args.stream:
+            flags.append(f'-DSTREAM')
+            flags.append(f'-DSTREAM_PAGES={self.args.stream_pages}')
+            flags.append(f'-DSTREAM_SAMPLE={self.args.stream_sample}')
+            flags.append(f'-DSTREAM_MIN_DURATION={int(self.args.stream_min_duration * 1e3)}')
+        if self.args.trigger:
+            flags.append(f'-DTRIGGER')
+            flags.append(f'-DTRIGGER_EVENTS={self.args.trigger_events}')
+            flags.append(f'-DTRIGGER_HOLDOFF={int(self.args.trigger_holdoff * 1e9)}')
+            if self.args.trigger_latency is not None:
+                flags.append(f'-DTRIGGER_LATENCY={int(self.args.trigger_latency * 1e3)}')
+            if self.args.trigger_rate is not None:
+                flags.append(f'-DTRIGGER_RATE={self.args.trigger_rate}')
+        if self.args.ngrams:
+            flags.append(f'-DNGRAM={self.args.ngrams}')
+            flags.append(f'-DNGRAMS_SIZE={self.args.ngrams_size}')
+        if self.args.futex:
+            flags.append(f'-DFUTEX')
+            flags.append(f'-DFUTEX_SIZE={self.args.futex_size}')
+            if self.args.futex_stacks:
+                flags.append(f'-DFUTEX_STACKS')
+        if self.args.stacks or self.args.futex_stacks:
+            flags.append(f'-DSTACKS_SIZE={self.args.stacks_size}')
+        if self.args.stacks:
+            flags.append(f'-DSTACKS')
+            flags.append(f'-DSTACKS_THRESHOLD={int(self.args.stacks_threshold * 1e3)}')
+            if self.args.kernel_stacks:
+                flags.append(f'-DKERNEL_STACKS')
 
         # Load BPF program
         self.bpf = BPF(src_file=f'{defs.BPF_PATH}/bpf_program.c', cflags=flags)
 
+        # Maybe open the time-series outfile
+        if self.args.format == 'timeseries':
+            self.open_timeseries()
+
+        # Maybe start streaming events
+        if self.args.stream:
+            self.open_stream()
+            self.bpf['events'].open_ring_buffer(self.handle_event)
+
+        # Maybe wait for triggers
+        if self.args.trigger:
+            self.bpf['triggers'].open_ring_buffer(self.handle_trigger)
+
+        # Maybe set up runtime filtering
+        if self.args.dynamic:
+            filter_enabled = bool(self.trace_pids or self.args.comm or self.args.cgroup
+                    or self.args.repeat)
+            self.set_filter(filter_enabled, self.args.follow)
+            for pid in self.trace_pids:
+                self.add_target(pid)
+            if self.args.comm:
+                comms = self.bpf['comms']
+                for comm in self.args.comm:
+                    comms[comms.Key(comm.encode('utf-8'))] = comms.Leaf(1)
+            for i, path in enumerate(self.args.cgroup or []):
+                self.bpf['cgroups'][i] = path
+
+        # Maybe start accounting the cost of our own programs
+        if self.args.self_stats:
+            self.enable_self_stats()
+
+        # Maybe time only some calls
+        if self.args.sample:
+            self.set_sample_rate(self.sample_rate)
+
+        # Preallocate buffers for reading the per-CPU arrays
+        self.snapshots['syscalls'] = MapSnapshot(self.bpf['syscalls'])
+        if self.args.hist:
+            self.snapshots['hists'] = MapSnapshot(self.bpf['hists'])
+        if self.args.errors:
+            self.snapshots['errnos'] = MapSnapshot(self.bpf['errnos'])
+        if self.args.io:
+            self.snapshots['io'] = MapSnapshot(self.bpf['io'])
+        if self.args.faults:
+            self.snapshots['faults'] = MapSnapshot(self.bpf['faults'])
+            if self.args.hist:
+                self.snapshots['fault_hists'] = MapSnapshot(self.bpf['fault_hists'])
+        if self.args.io_uring:
+            self.snapshots['uring'] = MapSnapshot(self.bpf['uring'])
+            if self.args.hist:
+                self.snapshots['uring_hists'] = MapSnapshot(self.bpf['uring_hists'])
+        if self.args.runq:
+            self.snapshots['runq'] = MapSnapshot(self.bpf['runq'])
+            self.snapshots['runq_hists'] = MapSnapshot(self.bpf['runq_hists'])
+        # Maybe only report some CPUs, the kernel keeps them all apart anyway
+        if self.args.cpus:
+            for snapshot in self.snapshots.values():
+                snapshot.select(self.args.cpus)
+
         # Register exit hook
         atexit.unregister(self.bpf.cleanup)
         atexit.register(self.on_exit)
 
+    def set_filter(self, enabled, follow):
+        """
+        Update the runtime filter configuration.
+        """
+        config = self.bpf['config']
+        config[config.Key(0)] = config.Leaf(os.getpid(), enabled, follow)
+        self.filter_enabled, self.follow = enabled, follow
+
+    def set_sample_rate(self, rate):
+        """
+        Time one in <rate> calls on each CPU from now on.
+        """
+        sample_rate = self.bpf['sample_rate']
+        sample_rate[sample_rate.Key(0)] = sample_rate.Leaf(rate)
+        self.sample_rate = rate
+
+    def adapt_sampling(self):
+        """
+        Rescale the sampling rate so that probe run time stays under --max-overhead.
+        Cost is roughly proportional to the number of timed calls, plus a floor
+        for the calls that are skipped, so aim for 3/4 of the budget.
+        """
+        if self.self_stats_start is None:
+            return
+        run_time = sum(t for t, _ in self.get_self_stats().values())
+        now = time.monotonic()
+        if self.last_adapt:
+            elapsed = max(now - self.last_adapt[1], 1e-9)
+            cost = (run_time - self.last_adapt[0]) / 1e9 / elapsed / os.cpu_count()
+            target = self.args.max_overhead / 100
+            if cost > target or cost < target / 2:
+                # At most 8x per step, so one noisy second cannot swing it far
+                factor = min(max(cost / (0.75 * target), 1 / 8), 8)
+                rate = min(max(round(self.sample_rate * factor), 1), defs.MAX_SAMPLE_RATE)
+                if rate != self.sample_rate:
+                    self.set_sample_rate(rate)
+        self.last_adapt = (run_time, now)
+
+    def add_target(self, pid):
+        """
+        Start tracing <pid> without reloading the BPF program.
+        """
+        targets = self.bpf['targets']
+        targets[targets.Key(pid)] = targets.Leaf(defs.TARGET_ROOT)
+        if not self.filter_enabled:
+            self.set_filter(True, self.follow)
+
+    def remove_target(self, pid):
+        """
+        Stop tracing <pid> without reloading the BPF program.
+        """
+        targets = self.bpf['targets']
+        try:
+            del targets[targets.Key(pid)]
+        except KeyError:
+            pass
+
+    def handle_command(self, command):
+        """
+        Handle one line written to the control fifo.
+        """
+        try:
+            if command[0] == 'add' and len(command) == 2:
+                self.add_target(int(command[1]))
+            elif command[0] == 'remove' and len(command) == 2:
+                self.remove_target(int(command[1]))
+            elif command[0] == 'follow' and command[1:] in (['on'], ['off']):
+                self.set_filter(self.filter_enabled, command[1] == 'on')
+            elif command == ['all']:
+                self.set_filter(False, self.follow)
+            else:
+                raise ValueError
+        except (IndexError, ValueError):
+            print(f'Ignoring invalid command "{" ".join(command)}"', file=sys.stderr)
+            return
+        print(f'Control: {" ".join(command)}', file=sys.stderr)
+
+    @drop_privileges
+    def make_control(self):
+        """
+        Create the control fifo as the invoking user.
+        """
+        os.mkfifo(self.args.control, 0o600)
+
+    def control(self):
+        """
+        Read commands from the control fifo until exit.
+        """
+        while 1:
+            # Blocks until a writer opens the fifo, EOF when it closes
+            with open(self.args.control, 'r') as f:
+                for line in f:
+                    if line.split():
+                        self.handle_command(line.split())
+
     def on_exit(self):
         print(file=sys.stderr)
         self.save_results()
+        self.save_stacks()
+        if self.timeseries:
+            self.timeseries.close()
+        if self.stream_writer:
+            with self.stream_lock:
+                self.bpf.ring_buffer_consume()
+            self.stream_writer.close()
+            print(f'Streamed {self.stream_writer.events} events to {self.args.stream}.', file=sys.stderr)
+        if self.args.control and os.path.exists(self.args.control):
+            os.unlink(self.args.control)
+        if self.bpf_stats_enabled is not None:
+            with open(defs.BPF_STATS_SYSCTL, 'w') as f:
+                f.write(self.bpf_stats_enabled)
         print('All done!', file=sys.stderr)
 
+    @drop_privileges
+    def open_stream(self):
+        """
+        Open the stream file as the invoking user.
+        """
+        self.stream_writer = stream.StreamWriter(open(self.args.stream, 'wb'))
+
+    @drop_privileges
+    def open_timeseries(self):
+        """
+        Open the time-series outfile as the invoking user and write its header.
+        """
+        names = [syscall_name(i) for i in range(num_syscalls())]
+        nbuckets = histogram.num_buckets(self.args.hist_sub_bits) if self.args.hist else 0
+        start_time = int(self.start_time.timestamp() * 1e9)
+        self.timeseries = timeseries.TimeSeriesWriter(open(self.args.outfile, 'wb'),
+                names, nbuckets, self.args.hist_sub_bits, start_time)
+
+    def handle_event(self, ctx, data, size):
+        """
+        Copy one ring buffer record into the stream file.
+        """
+        self.stream_writer.write(ct.string_at(data, size))
+
+    def handle_trigger(self, ctx, data, size):
+        """
+        Capture a snapshot around a trigger without blocking the ring buffers.
+        """
+        trigger = self.bpf['triggers'].event(data)
+        self.triggers += 1
+        threading.Thread(target=self.capture_trigger, daemon=True, args=(self.triggers,
+                trigger.time, trigger.reason, trigger.sysnum, trigger.value)).start()
+
+    def capture_trigger(self, n, trigger_time, reason, sysnum, value):
+        """
+        Record the results delta over the trigger window and the recent calls
+        of every CPU that ended within it.
+        """
+        wall_time = datetime.datetime.now()
+        low = trigger_time - int(self.args.trigger_before * 1e6)
+        high = trigger_time + int(self.args.trigger_after * 1e6)
+        # Copy the calls before the trigger now, a busy CPU overwrites them soon
+        events = self.read_recent(low, high)
+        start = time.monotonic()
+        before = self.read_results()
+        time.sleep(self.args.trigger_after / 1e3)
+        after = self.read_results()
+        elapsed = max(time.monotonic() - start, 1e-9)
+        # Calls seen in both copies are the same records
+        events = sorted(events | self.read_recent(low, high), key=lambda e: e[2] + e[3])
+
+        reason = defs.TRIGGER_REASONS.get(reason, reason)
+        unit = 'us' if reason == 'latency' else 'calls/s'
+        value = value / 1e3 if reason == 'latency' else value
+        results_str = f'Trigger:      {reason} of {syscall_name(sysnum)} ({value:.3f} {unit})\n'
+        results_str += f'Time:         {wall_time}\n'
+        results_str += f'Window:       {self.args.trigger_before} ms before, {self.args.trigger_after} ms after\n'
+        results_str += '\n'
+        results_str += f'System calls in the {elapsed * 1e3:.3f} ms after the trigger:\n'
+        results_str += report.format_table(self.diff_results(after, before, elapsed),
+                self.args.sort, self.args.sysnum, self.args.hist, True, self.args.offcpu,
+                bool(self.args.io), self.args.errors, bool(self.args.sample))
+        results_str += f'\n{len(events)} calls ending within the window, by end time:\n'
+        results_str += report.format_trigger_events(events, trigger_time)
+        path = os.path.join(self.args.trigger_dir, f'trigger-{n}.txt')
+        self.write_trigger(path, results_str)
+        print(f'Trigger {n}: {reason} of {syscall_name(sysnum)}, wrote {path}', file=sys.stderr)
+
+    def read_recent(self, low, high):
+        """
+        Return the set of (tid, sysnum, start_time, duration, ret) calls in the
+        per-CPU circular buffers that ended within [<low>, <high>] ns.
+        """
+        events = set()
+        for percpu_events in self.bpf['recent'].values():
+            for e in percpu_events:
+                if e.start_time and low <= e.start_time + e.duration <= high:
+                    events.add((e.tid, e.sysnum, e.start_time, e.duration, e.ret))
+        return events
+
+    @drop_privileges
+    def write_trigger(self, path, results_str):
+        """
+        Write a trigger snapshot as the invoking user.
+        """
+        with open(path, 'w') as f:
+            f.write(results_str)
+
+    def drain_ring_buffers(self):
+        """
+        Drain the events and triggers ring buffers in batches whenever they have data.
+        """
+        while 1:
+            # Waits on the ring buffer's epoll fd, then consumes every pending record
+            with self.stream_lock:
+                self.bpf.ring_buffer_poll(100)
+
     def timer(self):
         """
         Timer for controlling duration and checkpoint.
         """
         while 1:
             curr_time = datetime.datetime.now()
-            if curr_time >= (self.last_checkpoint + self.checkpoint):
+            # Scrapes replace checkpoints when serving metrics
+            if not self.args.serve and curr_time >= (self.last_checkpoint + self.checkpoint):
                 self.last_checkpoint = curr_time
                 self.save_results()
+                self.save_stacks()
             if self.duration and curr_time >= self.duration + self.start_time:
                 self.should_exit = 1
+            if self.args.max_overhead:
+                self.adapt_sampling()
             time.sleep(1)
 
-    def sort_func(self, v):
-        """
-        Return correct dict value based on sort argument.
-        """
-        if self.args.sort == 'sysname':
-            return v[0]
-        try:
-            return v[1][self.args.sort]
-        except:
-            raise TypeError(f"Unable to sort based on {self.args.sort}")
-
     def get_results(self):
         """
         Get benchmark results.
         """
         results = {}
-        for key, percpu_syscall in self.bpf['syscalls'].iteritems():
-            count = 0
-            overhead = 0.0
-            for syscall in percpu_syscall:
-                count += syscall.count
-                overhead += syscall.overhead
+        syscalls = self.snapshots['syscalls']
+        syscalls.read()
+        if self.args.hist:
+            self.snapshots['hists'].read()
+        if self.args.errors:
+            self.snapshots['errnos'].read()
+        if self.args.io:
+            self.snapshots['io'].read()
+        if self.args.runq:
+            self.snapshots['runq'].read()
+            self.snapshots['runq_hists'].read()
+        elapsed = max((datetime.datetime.now() - self.start_time).total_seconds(), 1e-9)
+        for sysnum in range(syscalls.size):
+            count = syscalls.sum(sysnum, 'count')
             if not count:
                 continue
+            maximum = syscalls.max(sysnum, 'max')
             # Convert to us from ns
-            overhead = overhead / 1e3
-            results[syscall_name(key.value)] = {
-                'sysnum': key.value,
+            overhead = syscalls.sum(sysnum, 'overhead') / 1e3
+            results[syscall_name(sysnum)] = {
+                'sysnum': sysnum,
                 'count': count,
                 'overhead': overhead,
+                'max': maximum / 1e3,
             }
             # Get average
             average_overhead = overhead / (count if count else 1)
-            results[syscall_name(key.value)]['avg_overhead'] = average_overhead
+            results[syscall_name(sysnum)]['avg_overhead'] = average_overhead
+            # Maybe split into time on and off the CPU
+            if self.args.offcpu:
+                offcpu = syscalls.sum(sysnum, 'offcpu') / 1e3
+                results[syscall_name(sysnum)]['offcpu'] = offcpu
+                results[syscall_name(sysnum)]['oncpu'] = overhead - offcpu
+            # Maybe get how many calls were actually timed
+            if self.args.sample:
+                results[syscall_name(sysnum)].update({
+                    'samples': syscalls.sum(sysnum, 'samples'),
+                    'sample_sq': sample_sq(syscalls, sysnum),
+                })
+                sampling_confidence(results[syscall_name(sysnum)])
+            # Maybe split successful and failed calls
+            if self.args.errors:
+                results[syscall_name(sysnum)].update({
+                    'errors': syscalls.sum(sysnum, 'err_count'),
+                    'err_overhead': syscalls.sum(sysnum, 'err_overhead') / 1e3,
+                    'errnos': self.get_errnos(sysnum),
+                })
+                error_split(results[syscall_name(sysnum)])
+            # Maybe get bytes and fd types of I/O calls
+            if self.args.io and sysnum in self.args.io:
+                io = self.get_io(sysnum, elapsed)
+                results[syscall_name(sysnum)]['io'] = io
+                results[syscall_name(sysnum)]['bytes'] = sum(v['bytes'] for v in io.values())
+                io_rates(results[syscall_name(sysnum)], elapsed)
+            # Maybe get run queue latency of threads inside this call
+            if self.args.runq:
+                results[syscall_name(sysnum)]['runq'] = self.get_runq(sysnum)
+            # Maybe get latency quantiles
+            if self.args.hist:
+                buckets = self.get_histogram(sysnum)
+                results[syscall_name(sysnum)]['hist'] = buckets
+                results[syscall_name(sysnum)].update(
+                    histogram.quantiles(buckets, self.args.hist_sub_bits, maximum)
+                )
         return results
 
+    def get_histogram(self, sysnum):
+        """
+        Get latency histogram buckets for <sysnum>, summed across CPUs.
+        """
+        hists = self.snapshots['hists']
+        nbuckets = histogram.num_buckets(self.args.hist_sub_bits)
+        base = sysnum * nbuckets
+        return [hists.sum(base + i) for i in range(nbuckets)]
+
+    def get_runq(self, sysnum):
+        """
+        Get run queue waits of threads inside <sysnum>, summed across CPUs.
+        """
+        runq = self.snapshots['runq']
+        runq_hists = self.snapshots['runq_hists']
+        nbuckets = histogram.num_buckets(self.args.hist_sub_bits)
+        base = sysnum * nbuckets
+        count = runq.sum(sysnum, 'count')
+        result = {
+            'count': count,
+            'overhead': runq.sum(sysnum, 'overhead') / 1e3,
+            'max': runq.max(sysnum, 'max') / 1e3,
+            'hist': [runq_hists.sum(base + i) for i in range(nbuckets)],
+        }
+        result['avg_overhead'] = result['overhead'] / count if count else 0.0
+        result.update(histogram.quantiles(result['hist'], self.args.hist_sub_bits, result['max'] * 1e3))
+        return result
+
+    def read_results(self):
+        """
+        Get results with their pseudo-rows. Both read the snapshot buffers
+        that timer, metrics and trigger threads share, under results_lock.
+        """
+        with self.results_lock:
+            return self.with_pseudo_rows(self.get_results())
+
+    def with_pseudo_rows(self, results):
+        """
+        Return <results> with a pseudo-row for each kind of user page fault
+        and io_uring opcode seen, shaped like a system call row so the table
+        can mix them.
+        """
+        if not self.args.faults and not self.args.io_uring:
+            return results
+        results = dict(results)
+        for name in ['faults', 'fault_hists', 'uring', 'uring_hists']:
+            if name in self.snapshots:
+                self.snapshots[name].read()
+        if self.args.faults:
+            for i, fault_type in enumerate(defs.FAULT_TYPES):
+                result = self.pseudo_row('faults', 'fault_hists', i, -1)
+                if result:
+                    results[f'[fault:{fault_type}]'] = result
+        if self.args.io_uring:
+            for i, (op, sync) in enumerate(defs.URING_OPS):
+                # Rows share the number of the equivalent call to sort next to it
+                sysnum = syscall_number(sync) if sync else None
+                result = self.pseudo_row('uring', 'uring_hists', i, -1 if sysnum is None else sysnum)
+                if result:
+                    results[f'[async:{op}]'] = result
+        return results
+
+    def pseudo_row(self, name, hists_name, i, sysnum):
+        """
+        Build the result of slot <i> of per-CPU data_t snapshot <name>,
+        already read, or None if it saw no events. These events are never sampled.
+        """
+        data = self.snapshots[name]
+        count = data.sum(i, 'count')
+        if not count:
+            return None
+        overhead = data.sum(i, 'overhead') / 1e3
+        maximum = data.max(i, 'max')
+        result = {
+            'sysnum': sysnum,
+            'count': count,
+            'overhead': overhead,
+            'max': maximum / 1e3,
+            'avg_overhead': overhead / count,
+        }
+        if self.args.sample:
+            result.update(samples=count, sample_sq=sample_sq(data, i))
+            sampling_confidence(result)
+        if self.args.errors:
+            result.update(errors=data.sum(i, 'err_count'),
+                    err_overhead=data.sum(i, 'err_overhead') / 1e3, errnos={})
+            error_split(result)
+        if self.args.hist:
+            hists = self.snapshots[hists_name]
+            nbuckets = histogram.num_buckets(self.args.hist_sub_bits)
+            buckets = [hists.sum(i * nbuckets + j) for j in range(nbuckets)]
+            result['hist'] = buckets
+            result.update(histogram.quantiles(buckets, self.args.hist_sub_bits, maximum))
+        return result
+
+    def get_errnos(self, sysnum):
+        """
+        Get {errno name: count} of failed calls to <sysnum>, summed across CPUs.
+        """
+        errnos = self.snapshots['errnos']
+        base = sysnum * len(defs.ERRNO_SLOTS)
+        counts = {}
+        for i, name in enumerate(defs.ERRNO_SLOTS):
+            count = errnos.sum(base + i)
+            if count:
+                counts[name] = count
+        return counts
+
+    def get_io(self, sysnum, elapsed):
+        """
+        Get I/O results for <sysnum> per fd type, summed across CPUs.
+        """
+        io = self.snapshots['io']
+        base = sysnum * len(defs.FD_TYPES)
+        by_type = {}
+        for i, fd_type in enumerate(defs.FD_TYPES):
+            count = io.sum(base + i, 'count')
+            if not count:
+                continue
+            overhead = io.sum(base + i, 'overhead') / 1e3
+            by_type[fd_type] = io_rates({
+                'count': count,
+                'overhead': overhead,
+                'avg_overhead': overhead / count,
+                'bytes': io.sum(base + i, 'bytes'),
+            }, elapsed)
+        return by_type
+
+    def get_cpus(self, results):
+        """
+        Get {cpu: totals} of the selected online CPUs for the syscalls in <results>,
+        from the per-CPU values that get_results() summed.
+        """
+        syscalls = self.snapshots['syscalls']
+        nodes = cpu_nodes()
+        cpus = {}
+        for cpu in (self.args.cpus or online_cpus()):
+            cpus[cpu] = {'node': nodes.get(cpu, 0), 'count': 0, 'overhead': 0.0, 'syscalls': {}}
+        for name, v in results.items():
+            counts = syscalls.percpu(v['sysnum'], 'count')
+            overheads = syscalls.percpu(v['sysnum'], 'overhead')
+            for cpu, e in cpus.items():
+                if cpu >= syscalls.ncpus or not counts[cpu]:
+                    continue
+                e['count'] += counts[cpu]
+                e['overhead'] += overheads[cpu] / 1e3
+                e['syscalls'][name] = overheads[cpu] / 1e3
+        return cpus
+
+    def get_interval_results(self, results):
+        """
+        Turn cumulative results into deltas and rates since the last call.
+        """
+        now = time.monotonic()
+        elapsed = max(now - self.last_interval, 1e-9)
+        interval = self.diff_results(results, self.prev_results, elapsed)
+        self.prev_results = results
+        self.last_interval = now
+        return interval, elapsed
+
+    def diff_results(self, results, prev_results, elapsed):
+        """
+        Return the deltas and rates of <results> since <prev_results>,
+        taken <elapsed> seconds earlier.
+        """
+        interval = {}
+        for name, v in results.items():
+            prev = prev_results.get(name)
+            count = v['count'] - (prev['count'] if prev else 0)
+            if not count:
+                continue
+            # Max is not decomposable, so it stays cumulative
+            interval[name] = dict(v)
+            for field in ADDITIVE_FIELDS:
+                if field in v:
+                    interval[name][field] = v[field] - (prev[field] if prev else 0)
+            overhead = interval[name]['overhead']
+            interval[name].update(avg_overhead=overhead / count,
+                    rate=count / elapsed, utilization=overhead / elapsed)
+            if 'samples' in v:
+                sampling_confidence(interval[name])
+            if 'errnos' in v:
+                error_split(interval[name])
+                interval[name]['errnos'] = {errno: n - (prev['errnos'].get(errno, 0) if prev else 0)
+                        for errno, n in v['errnos'].items()}
+            if 'io' in v:
+                io_rates(interval[name], elapsed)
+                interval[name]['io'] = {}
+                for fd_type, e in v['io'].items():
+                    p = prev['io'].get(fd_type) if prev else None
+                    e = {field: e[field] - (p[field] if p else 0) for field in ['count', 'overhead', 'bytes']}
+                    if e['count']:
+                        e['avg_overhead'] = e['overhead'] / e['count']
+                        interval[name]['io'][fd_type] = io_rates(e, elapsed)
+            if 'runq' in v:
+                p = prev['runq'] if prev else None
+                e = {field: v['runq'][field] - (p[field] if p else 0) for field in ['count', 'overhead']}
+                e['max'] = v['runq']['max']
+                e['hist'] = [a - b for a, b in zip(v['runq']['hist'], p['hist'])] if p else v['runq']['hist']
+                e['avg_overhead'] = e['overhead'] / e['count'] if e['count'] else 0.0
+                e.update(histogram.quantiles(e['hist'], self.args.hist_sub_bits, e['max'] * 1e3))
+                interval[name]['runq'] = e
+            if self.args.hist:
+                buckets = v['hist']
+                if prev:
+                    buckets = [a - b for a, b in zip(buckets, prev['hist'])]
+                interval[name]['hist'] = buckets
+                interval[name].update(histogram.quantiles(
+                    buckets, self.args.hist_sub_bits, v['max'] * 1e3))
+        return interval
+
+    def selected_cpus(self, percpu):
+        """
+        Return the entries of a per-CPU map value for the --cpus selection.
+        """
+        if not self.args.cpus:
+            return percpu
+        return [percpu[cpu] for cpu in self.args.cpus if cpu < len(percpu)]
+
+    def get_breakdown(self):
+        """
+        Get the top consumers by overhead, each with their system calls.
+        """
+        consumers = {}
+        for key, percpu_data in self.bpf['breakdown'].iteritems():
+            percpu_data = self.selected_cpus(percpu_data)
+            count = sum(data.count for data in percpu_data)
+            if not count:
+                continue
+            overhead = sum(data.overhead for data in percpu_data) / 1e3
+            consumer = consumers.setdefault(key.id, {
+                'count': 0,
+                'overhead': 0.0,
+                'syscalls': {},
+            })
+            consumer['count'] += count
+            consumer['overhead'] += overhead
+            consumer['syscalls'][syscall_name(key.sysnum)] = overhead
+        top = sorted(consumers.items(), key=lambda c: c[1]['overhead'], reverse=1)
+        return top[:self.args.top]
+
+    def consumer_name(self, consumer_id):
+        """
+        Return a printable name for a breakdown consumer id.
+        """
+        if self.args.breakdown == 'cgroup':
+            return cgroup_path(consumer_id)
+        return process_name(consumer_id)
+
+    def collect_metrics(self):
+        """
+        Read the maps and render them for a metrics scrape.
+        """
+        with self.results_lock:
+            results = self.get_results()
+        sub_bits = self.args.hist_sub_bits if self.args.hist else None
+        return metrics.exposition(results, self.get_stats(), sub_bits, self.sample_rate,
+                self.args.hist_sub_bits)
+
+    def get_stacks(self):
+        """
+        Fold recorded stacks into (frames, overhead) pairs, heaviest first.
+        Symbolizing needs /proc/kallsyms and /proc/<pid>/maps, so this runs as root.
+        """
+        stack_traces = self.bpf['stack_traces']
+        folded = {}
+        for key, data in self.bpf['stacks'].items():
+            frames = [process_name(key.tgid)]
+            if key.user_stack >= 0:
+                # Stacks are walked from the innermost frame
+                addrs = reversed(list(stack_traces.walk(key.user_stack)))
+                frames += [self.bpf.sym(addr, key.tgid).decode('utf-8', 'replace') for addr in addrs]
+            else:
+                frames.append('[missing user stack]')
+            frames.append(syscall_name(key.sysnum))
+            if key.kernel_stack >= 0:
+                addrs = reversed(list(stack_traces.walk(key.kernel_stack)))
+                frames += [self.bpf.ksym(addr).decode('utf-8', 'replace') + '_[k]' for addr in addrs]
+            line = ';'.join(frame.replace(';', ':') for frame in frames)
+            folded[line] = folded.get(line, 0) + data.overhead
+        return sorted(folded.items(), key=lambda s: s[1], reverse=1)
+
+    def get_ngrams(self):
+        """
+        Get the --ngrams-top system call sequences by summed latency.
+        """
+        sequences = []
+        for key, percpu_data in self.bpf['ngrams'].items():
+            percpu_data = self.selected_cpus(percpu_data)
+            count = sum(data.count for data in percpu_data)
+            if not count:
+                continue
+            overhead = sum(data.overhead for data in percpu_data) / 1e3
+            sequences.append({
+                'syscalls': [syscall_name(num) for num in key.sysnum],
+                'count': count,
+                'overhead': overhead,
+                'avg_overhead': overhead / count,
+            })
+        return sorted(sequences, key=lambda s: s['overhead'], reverse=True)[:self.args.ngrams_top]
+
+    def get_futexes(self):
+        """
+        Get the --futex-top lock words by total wait time.
+        Symbolizing needs /proc/<pid>/maps, so this runs as root.
+        """
+        futexes = []
+        for key, percpu in self.bpf['futexes'].items():
+            waits = [futex for futex in self.selected_cpus(percpu) if futex.wait.count]
+            if not waits:
+                continue
+            futexes.append({
+                'tgid': key.tgid,
+                'uaddr': key.uaddr,
+                'count': sum(futex.wait.count for futex in waits),
+                'overhead': sum(futex.wait.overhead for futex in waits) / 1e3,
+                'max': max(futex.wait.max for futex in waits) / 1e3,
+                'slowest': max(waits, key=lambda futex: futex.wait.max),
+            })
+        futexes = sorted(futexes, key=lambda f: f['overhead'], reverse=True)[:self.args.futex_top]
+        stack_traces = self.bpf['stack_traces'] if self.args.futex_stacks else None
+        for futex in futexes:
+            slowest = futex.pop('slowest')
+            futex['avg_overhead'] = futex['overhead'] / futex['count']
+            futex['frames'] = []
+            if stack_traces and slowest.user_stack >= 0:
+                futex['frames'] = [self.bpf.sym(addr, futex['tgid']).decode('utf-8', 'replace')
+                        for addr in stack_traces.walk(slowest.user_stack)]
+        return futexes
+
+    def save_stacks(self):
+        """
+        Rewrite the folded stacks file with every stack recorded so far.
+        """
+        if self.args.stacks:
+            self.write_stacks(self.get_stacks())
+
     @drop_privileges
+    def write_stacks(self, folded):
+        """
+        Write folded stacks as the invoking user, one "frames us" line each.
+        """
+        with open(self.args.stacks, 'w') as f:
+            for line, overhead in folded:
+                f.write(f'{line} {round(overhead / 1e3)}\n')
+
+    def enable_self_stats(self):
+        """
+        Turn on kernel run-time accounting of BPF programs until exit.
+        """
+        try:
+            with open(defs.BPF_STATS_SYSCTL, 'r') as f:
+                enabled = f.read().strip()
+            with open(defs.BPF_STATS_SYSCTL, 'w') as f:
+                f.write('1')
+        except OSError as e:
+            print(f'Unable to enable BPF statistics ({e}), --self-stats needs Linux >= 5.1.',
+                    file=sys.stderr)
+            return
+        self.bpf_stats_enabled = enabled
+        self.self_stats_start = time.monotonic()
+
+    def get_self_stats(self):
+        """
+        Get {program: (run_time_ns, run_cnt)} for each loaded BPF program.
+        The kernel only counts while bpf_stats_enabled is set.
+        """
+        stats = {}
+        for name, func in self.bpf.funcs.items():
+            info = {}
+            # Readable after dropping privileges too, it is our own fd
+            with open(f'/proc/self/fdinfo/{func.fd}', 'r') as f:
+                for line in f:
+                    key, _, value = line.partition(':')
+                    info[key] = value.strip()
+            name = name.decode('utf-8').replace('raw_tracepoint__', '')
+            stats[name] = (int(info.get('run_time_ns', 0)), int(info.get('run_cnt', 0)))
+        return stats
+
+    def format_self_stats(self):
+        """
+        Describe probe cost per event and as a share of CPU time since it was enabled.
+        """
+        stats = self.get_self_stats()
+        elapsed = max(time.monotonic() - self.self_stats_start, 1e-9)
+        run_time = sum(t for t, _ in stats.values())
+        cpu = run_time / 1e9 / elapsed
+        ncpus = os.cpu_count()
+        lines = f'Probe cost:   {cpu:.3%} of one CPU, {cpu / ncpus:.3%} of {ncpus} CPUs\n'
+        for name, (t, n) in sorted(stats.items()):
+            lines += f'              {name}: {t / n if n else 0:.1f} ns/event x {n} events\n'
+        return lines
+
+    def get_stats(self):
+        """
+        Get tracking statistics, summed across CPUs.
+        """
+        stats = self.bpf['stats']
+        def get_stat(index):
+            return sum(stats[stats.Key(index)])
+        unmatched_enter = get_stat(defs.STAT_UNMATCHED_ENTER)
+        unmatched_exit = get_stat(defs.STAT_UNMATCHED_EXIT)
+        return {
+            'unmatched': unmatched_enter + unmatched_exit,
+            'unmatched_enter': unmatched_enter,
+            'unmatched_exit': unmatched_exit,
+            'dropped': get_stat(defs.STAT_TRACKING_FULL),
+            'stream_dropped': get_stat(defs.STAT_STREAM_DROPPED),
+            'stacks_lost': get_stat(defs.STAT_STACKS_LOST),
+        }
+
     def save_results(self):
         """
         Save benchmark results.
+        Runs as root so that addresses can be symbolized, see write_results().
         """
-        results = self.get_results()
-        f = open(self.args.outfile, 'w') if self.args.outfile else sys.stderr
+        with self.results_lock:
+            results = self.get_results()
+            if self.args.per_cpu or self.args.per_node:
+                cpus = self.get_cpus(results)
+            all_results = self.with_pseudo_rows(results)
+        if self.timeseries:
+            self.timeseries.write(time.time_ns(), results)
+        results = all_results
+        # Exports stay cumulative so that they can be merged
+        if self.args.format == 'export':
+            self.write_export(results)
+        if self.args.interval:
+            results, elapsed = self.get_interval_results(results)
+        stats = self.get_stats()
+        # Rows are already appended, the text table only goes to stderr
+        if self.args.format != 'text' and not self.args.tee:
+            return
         results_str = ''
         # Add timestamp
         curr_time = datetime.datetime.now()
         # String += is O(n^2) in Python, don't try this at home, kids
         results_str += f'Start time:   {self.start_time}\n'
         results_str += f'Current time: {curr_time}\n'
-        results_str += f'Time elapsed: {(curr_time - self.start_time)}\n\n'
-        # Add header
-        if self.args.sysnum:
-            results_str += f'{"NUM":<3s} '
-        results_str += f'{"SYSCALL":<22s} {"COUNT":>8s} {"OVERHEAD(us)":>22s} {"AVG_OVERHEAD(us/call)":>22s}'
+        results_str += f'Time elapsed: {(curr_time - self.start_time)}\n'
+        if self.args.interval:
+            results_str += f'Interval:     {datetime.timedelta(seconds=elapsed)}\n'
+        results_str += f'Unmatched:    {stats["unmatched"]} enter/exit pairs\n'
+        if self.args.sample:
+            adaptive = f' (adaptive, max {self.args.max_overhead}% CPU)' if self.args.max_overhead else ''
+            results_str += f'Sampling:     1 in {self.sample_rate} calls per CPU{adaptive}\n'
+        if self.self_stats_start is not None:
+            results_str += f'              {stats["unmatched_enter"]} enters overwritten, {stats["unmatched_exit"]} exits without enter\n'
+            results_str += self.format_self_stats()
+        if stats['dropped']:
+            results_str += f'Dropped:      {stats["dropped"]} calls (raise --max-threads)\n'
+        if self.args.stream:
+            results_str += f'Stream drops: {stats["stream_dropped"]} events (raise --stream-pages)\n'
+        if self.args.stacks or self.args.futex_stacks:
+            results_str += f'Stack drops:  {stats["stacks_lost"]} slow calls (raise --stacks-size)\n'
         results_str += '\n'
-        # Add results
-        for k, v in sorted(
-            results.items(), key=self.sort_func, reverse=self.reverse_sort
-        ):
-            if self.args.sysnum:
-                results_str += f'{v["sysnum"]:<3d} '
-            results_str += f'{k:<22s} {v["count"]:>8d} {v["overhead"] :>22.3f}{v["avg_overhead"] :>22.3f}'
+        # Repeated runs get per-iteration and aggregate statistics instead of the table
+        if self.args.repeat:
+            results_str += report.format_iterations(self.iterations)
+            results_str += '\n'
+            results_str += report.format_repeat_table(self.iterations)
+        else:
+            # Add table
+            results_str += report.format_table(results, self.args.sort,
+                    self.args.sysnum, self.args.hist, self.args.interval, self.args.offcpu,
+                    bool(self.args.io), self.args.errors, bool(self.args.sample))
+        # Add I/O by fd type
+        if self.args.io and not self.args.repeat:
+            results_str += '\nI/O by file descriptor type:\n'
+            results_str += report.format_io_table(results)
+        # Compare io_uring requests with the system calls doing the same work
+        if self.args.io_uring and not self.args.repeat:
+            results_str += '\nio_uring requests and their synchronous equivalents:\n'
+            results_str += report.format_async_table(results)
+        # Add run queue latency next to the system call latency it is part of
+        if self.args.runq and not self.args.repeat:
+            results_str += '\nRun queue latency of threads inside system calls:\n'
+            results_str += report.format_runq_table(results)
             results_str += '\n'
-        f.write(results_str + '\n')
-        if self.args.tee:
+            results_str += report.format_log2_hist(report.merged_runq_hist(results),
+                    self.args.hist_sub_bits)
+        # Add per-CPU and per-node totals, since the start even in interval mode
+        if self.args.per_cpu:
+            results_str += '\nSystem calls by CPU since start:\n'
+            results_str += report.format_cpu_table(cpus)
+        if self.args.per_node:
+            results_str += '\nSystem calls by NUMA node since start:\n'
+            results_str += report.format_node_table(cpus)
+        # Add the hottest system call sequences
+        if self.args.ngrams:
+            results_str += f'\nTop {self.args.ngrams_top} sequences of {self.args.ngrams} system calls since start:\n'
+            results_str += report.format_ngram_table(self.get_ngrams())
+        # Add the most contended lock words
+        if self.args.futex:
+            results_str += f'\nTop {self.args.futex_top} futexes by wait time since start:\n'
+            results_str += report.format_futex_table(self.get_futexes())
+        # Add top consumers
+        if self.args.breakdown:
+            kind = 'CGROUP' if self.args.breakdown == 'cgroup' else 'PID'
+            results_str += f'\nTop {self.args.top} consumers by overhead:\n'
+            results_str += f'{kind:<10s} {"NAME":<32s} {"COUNT":>10s} {"OVERHEAD(us)":>22s}  TOP SYSCALLS\n'
+            for consumer_id, v in self.get_breakdown():
+                top_syscalls = sorted(v['syscalls'].items(), key=lambda s: s[1], reverse=1)[:3]
+                top_syscalls = ', '.join(name for name, _ in top_syscalls)
+                results_str += f'{consumer_id:<10d} {self.consumer_name(consumer_id):<32.32s} {v["count"]:>10d} {v["overhead"]:>22.3f}  {top_syscalls}\n'
+        self.write_results(results_str)
+
+    @drop_privileges
+    def write_results(self, results_str):
+        """
+        Write the text results as the invoking user.
+        """
+        if self.args.outfile and self.args.format == 'text':
+            with open(self.args.outfile, 'w') as f:
+                f.write(results_str + '\n')
+        if self.args.tee or not self.args.outfile:
             sys.stderr.write(results_str + '\n')
-        if self.args.outfile:
-            f.close()
+
+    @drop_privileges
+    def write_export(self, results):
+        """
+        Rewrite the export outfile as the invoking user.
+        """
+        meta = export.metadata(int(self.start_time.timestamp() * 1e9), time.time_ns(), self.args.clock)
+        export.save(self.args.outfile, results, meta, self.args.hist_sub_bits if self.args.hist else None)
 
     def handle_sigchld(self, x, y):
         """
@@ -195,22 +1144,55 @@ class BPFBench:
             sys.exit(-1)
         # Wake up and do nothing on SIGUSR1
         signal.signal(signal.SIGUSR1, lambda x, y: None)
-        # Reap zombies
-        signal.signal(signal.SIGCHLD, self.handle_sigchld)
+        # Reap zombies, repeated runs wait for each iteration themselves
+        if not self.args.repeat:
+            signal.signal(signal.SIGCHLD, self.handle_sigchld)
+        # Keep SIGUSR1 pending until the child waits for it, however soon it comes
+        signal.pthread_sigmask(signal.SIG_BLOCK, {signal.SIGUSR1})
         pid = os.fork()
         # Setup traced process
         if pid == 0:
-            signal.pause()
+            signal.sigwait({signal.SIGUSR1})
+            signal.pthread_sigmask(signal.SIG_UNBLOCK, {signal.SIGUSR1})
+            if self.args.pin_cpu is not None:
+                os.sched_setaffinity(0, {self.args.pin_cpu})
+            if self.args.randomize_env:
+                # Shifts the initial stack, so layout effects average out over iterations
+                os.environ['BPFBENCH_PAD'] = 'x' * random.randrange(4096)
             os.execvp(binary, args)
+        signal.pthread_sigmask(signal.SIG_UNBLOCK, {signal.SIGUSR1})
         # Return pid of traced process
         return pid
 
+    def run_iterations(self):
+        """
+        Run the -r program --warmup + --repeat times under the loaded BPF program,
+        keeping the results of each measured iteration.
+        """
+        total = self.args.warmup + self.args.repeat
+        for i in range(total):
+            pid = self.run_binary(self.args.run, self.args.runargs)
+            self.add_target(pid)
+            # Snapshot right before starting, deltas are then this iteration only
+            self.prev_results = self.read_results()
+            self.last_interval = time.monotonic()
+            os.kill(pid, signal.SIGUSR1)
+            os.waitpid(pid, 0)
+            results, elapsed = self.get_interval_results(self.read_results())
+            self.remove_target(pid)
+            warmup = i < self.args.warmup
+            if not warmup:
+                self.iterations.append((elapsed, results))
+            print(f'{"Warmup" if warmup else "Iteration"} {i + 1}/{total}: {elapsed * 1e3:.3f} ms',
+                    file=sys.stderr)
+
     def bench(self):
         """
         Run benchmarking.
         """
         self.start_time = datetime.datetime.now()
         self.last_checkpoint = datetime.datetime.now()
+        self.last_interval = time.monotonic()
 
         print(
             f'Duration:   {self.duration if self.duration else "Forever"}',
@@ -219,21 +1201,35 @@ class BPFBench:
         print(f'Checkpoint: {self.checkpoint}', file=sys.stderr)
         print(f'Start time: {self.start_time}', file=sys.stderr)
 
+        # Maybe run a program many times, once the BPF program is loaded
+        if self.args.repeat:
+            print(
+                f'Running \"{" ".join(self.args.runargs)}\" {self.args.repeat} times after {self.args.warmup} warmup runs...',
+                file=sys.stderr,
+            )
         # Maybe run a program
-        if self.args.run:
+        elif self.args.run:
             print(
                 f'Tracing \"{" ".join(self.args.runargs)}\" for {self.duration if self.duration else "Forever"}...',
                 file=sys.stderr,
             )
             self.trace_pid = self.run_binary(self.args.run, self.args.runargs)
-        # Maybe trace a pid
-        elif self.args.pid:
+            self.trace_pids.append(self.trace_pid)
+        # Maybe trace pids, command names or cgroups
+        targets = []
+        if self.args.pid:
+            self.trace_pids += self.args.pid
+            targets.append(f'pid {",".join(str(pid) for pid in self.args.pid)}')
+        if self.args.comm:
+            targets.append(f'comm {",".join(self.args.comm)}')
+        if self.args.cgroup:
+            targets.append(f'cgroup {",".join(self.args.cgroup)}')
+        if targets:
             print(
-                f'Tracing pid {self.args.pid} for {self.duration if self.duration else "Forever"}...',
+                f'Tracing {"; ".join(targets)} for {self.duration if self.duration else "Forever"}...',
                 file=sys.stderr,
             )
-            self.trace_pid = int(self.args.pid)
-        else:
+        elif not self.args.run:
             print(
                 f'Tracing system for {self.duration if self.duration else "Forever"}...',
                 file=sys.stderr,
@@ -245,6 +1241,28 @@ class BPFBench:
         if self.args.run and self.trace_pid:
             os.kill(self.trace_pid, signal.SIGUSR1)
 
+        # Start accepting control commands
+        if self.args.control:
+            self.make_control()
+            self.control_thread.start()
+            print(f'Accepting commands on {self.args.control}', file=sys.stderr)
+
+        # Start draining the stream and triggers
+        if self.args.stream or self.args.trigger:
+            self.stream_thread.start()
+
+        if self.args.repeat:
+            self.run_iterations()
+            sys.exit()
+
+        # Maybe start serving metrics
+        if self.args.serve:
+            host, port = self.args.serve
+            self.metrics_server = metrics.MetricsServer(host, port,
+                    self.collect_metrics, self.args.metrics_ttl)
+            self.metrics_server.start()
+            print(f'Serving metrics on http://{host}:{port}/metrics', file=sys.stderr)
+
         # Start the timer
         self.timer_thread.start()
         while 1:
@@ -253,10 +1271,21 @@ class BPFBench:
                 sys.exit()
 
 
+# Offline tools that work on result files, bpfbench <tool> [args]
+TOOLS = {
+    'convert': (parse_convert_args, timeseries.convert),
+    'compare': (parse_compare_args, compare.compare),
+    'merge': (parse_merge_args, export.merge),
+}
+
 def main():
     """
     Parse arguments and run the benchmark.
     """
+    if len(sys.argv) > 1 and sys.argv[1] in TOOLS:
+        parse_tool_args, tool = TOOLS[sys.argv[1]]
+        tool(parse_tool_args(sys.argv[2:]))
+        return
     args = parse_args()
     bpf_bench = BPFBench(args)
     bpf_bench.bench()
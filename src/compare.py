@@ -0,0 +1,293 @@
+# bpfbench  A better benchmarking tool written in eBPF.
+# Copyright (C) 2020  William Findlay
+#
+# Heavily inspired by syscount from bcc-tools:
+# https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+import sys
+import math
+
+from src import export, histogram, timeseries
+
+# Leading header words of the per-syscall table, after an optional NUM
+TEXT_HEADER = ['SYSCALL', 'COUNT', 'OVERHEAD(us)', 'AVG_OVERHEAD(us/call)']
+
+# Columns of the text table that compare understands, by header
+TEXT_COLUMNS = {
+    'NUM': ('sysnum', lambda word: -1 if word == '-' else int(word)),
+    'COUNT': ('count', int),
+    'OVERHEAD(us)': ('overhead', float),
+    'AVG_OVERHEAD(us/call)': ('avg_overhead', float),
+    'P50(us)': ('p50', float),
+    'P90(us)': ('p90', float),
+    'P99(us)': ('p99', float),
+    'P99.9(us)': ('p99.9', float),
+    'MAX(us)': ('max', float),
+}
+
+
+class Run:
+    """
+    Per-syscall results of one benchmark run, with histograms if the file has them.
+    """
+
+    def __init__(self, path, results, sub_bits=None):
+        self.path = path
+        self.results = results
+        self.sub_bits = sub_bits
+
+
+def load_timeseries(path, at):
+    """
+    Load snapshot <at> of a time-series file.
+    """
+    reader = timeseries.TimeSeriesReader(path)
+    checkpoints = reader.checkpoints()
+    if not checkpoints:
+        raise ValueError(f'{path} has no snapshots yet.')
+    try:
+        _, results = reader.snapshot(checkpoints[at])
+    except IndexError:
+        raise ValueError(f'{path} only has {len(checkpoints)} snapshots.')
+    return Run(path, results, reader.sub_bits if reader.nbuckets else None)
+
+
+def split_row(words, columns):
+    """
+    Map the words of a table row to <columns> by position, keeping names
+    with spaces such as "[unknown: 500]" in one SYSCALL value.
+    """
+    name_at = columns.index('SYSCALL')
+    end = name_at + 1
+    if words[name_at].startswith('[') and not words[name_at].endswith(']'):
+        while end < len(words) and not words[end - 1].endswith(']'):
+            end += 1
+    words = words[:name_at] + [' '.join(words[name_at:end])] + words[end:]
+    return dict(zip(columns, words))
+
+
+def load_text(path):
+    """
+    Load the last per-syscall table of a text outfile. Only quantiles survive
+    the text format. Other tables, such as I/O by fd type, are skipped.
+    """
+    tables = []
+    columns = None
+    with open(path, 'r') as f:
+        for line in f:
+            words = line.split()
+            if words[words[:1] == ['NUM']:][:len(TEXT_HEADER)] == TEXT_HEADER:
+                columns = words
+                tables.append({})
+                continue
+            if not words:
+                columns = None
+            if not columns:
+                continue
+            try:
+                row = split_row(words, columns)
+                result = {key: convert(row[name]) for name, (key, convert) in TEXT_COLUMNS.items()
+                        if name in row}
+            except (ValueError, KeyError, IndexError):
+                # Skip the row, not the rest of the table
+                continue
+            tables[-1][row['SYSCALL']] = result
+    if not tables:
+        raise ValueError(f'{path} has no bpfbench table.')
+    return Run(path, tables[-1])
+
+
+def load_export(path):
+    """
+    Load an export file, e.g. the output of bpfbench merge.
+    """
+    _, sub_bits, rows = export.read(path)
+    return Run(path, export.to_results(rows, sub_bits), sub_bits)
+
+
+def load(path, at=-1):
+    """
+    Load a time-series, export or text outfile.
+    """
+    with open(path, 'rb') as f:
+        magic = f.read(len(timeseries.MAGIC))
+    if magic == timeseries.MAGIC:
+        return load_timeseries(path, at)
+    if magic == export.MAGIC:
+        return load_export(path)
+    return load_text(path)
+
+
+def moments(buckets, sub_bits):
+    """
+    Estimate the mean and variance in ns of a histogram from bucket midpoints.
+    """
+    n = sum(buckets)
+    mids = [sum(histogram.bucket_bounds(i, sub_bits)) / 2 for i in range(len(buckets))]
+    mean = sum(c * m for c, m in zip(buckets, mids)) / n
+    var = sum(c * (m - mean) ** 2 for c, m in zip(buckets, mids)) / max(n - 1, 1)
+    return mean, var
+
+
+def welch_p(a, b, sub_bits):
+    """
+    Two-sided p-value of a difference in mean latency, with a normal
+    approximation of Welch's t-test on histogram moments.
+    """
+    na, nb = sum(a), sum(b)
+    mean_a, var_a = moments(a, sub_bits)
+    mean_b, var_b = moments(b, sub_bits)
+    se = math.sqrt(var_a / na + var_b / nb)
+    if not se:
+        return 1.0 if mean_a == mean_b else 0.0
+    z = (mean_b - mean_a) / se
+    return math.erfc(abs(z) / math.sqrt(2))
+
+
+def ks_test(a, b):
+    """
+    Two-sample Kolmogorov-Smirnov statistic D and its asymptotic p-value,
+    over bucket boundaries. Ties within a bucket make the test conservative.
+    """
+    na, nb = sum(a), sum(b)
+    d = seen_a = seen_b = 0
+    for ca, cb in zip(a, b):
+        seen_a += ca
+        seen_b += cb
+        d = max(d, abs(seen_a / na - seen_b / nb))
+    en = math.sqrt(na * nb / (na + nb))
+    lam = (en + 0.12 + 0.11 / en) * d
+    if lam < 0.2:
+        return d, 1.0
+    p = 2 * sum((-1) ** (k - 1) * math.exp(-2 * k * k * lam * lam) for k in range(1, 101))
+    return d, min(max(p, 0.0), 1.0)
+
+
+def relative(a, b):
+    """
+    Relative change from <a> to <b>, or None if there was nothing before.
+    """
+    return (b - a) / a if a else None
+
+
+def compare_syscall(a, b, sub_bits):
+    """
+    Compare the results of one syscall in two runs. Missing results count as zero.
+    """
+    zero = {'count': 0, 'overhead': 0.0, 'avg_overhead': 0.0}
+    ra, rb = a or zero, b or zero
+    row = {
+        'count_a': ra['count'],
+        'count_b': rb['count'],
+        'count_delta': relative(ra['count'], rb['count']),
+        'mean_a': ra['avg_overhead'],
+        'mean_b': rb['avg_overhead'],
+        'mean_delta': relative(ra['avg_overhead'], rb['avg_overhead']),
+        'impact': rb['overhead'] - ra['overhead'],
+        'p99_delta': None,
+        'p_mean': None,
+        'ks': None,
+        'p_ks': None,
+    }
+    if 'p99' in ra and 'p99' in rb:
+        row['p99_delta'] = relative(ra['p99'], rb['p99'])
+    # Empty histograms, e.g. of an idle interval, have no moments
+    if sub_bits is not None and a and b and sum(a['hist']) and sum(b['hist']):
+        row['p_mean'] = welch_p(a['hist'], b['hist'], sub_bits)
+        row['ks'], row['p_ks'] = ks_test(a['hist'], b['hist'])
+    return row
+
+
+def compare_runs(run_a, run_b):
+    """
+    Return {syscall: comparison} for every syscall seen in either run.
+    """
+    sub_bits = None
+    if run_a.sub_bits is not None and run_b.sub_bits is not None:
+        sub_bits = min(run_a.sub_bits, run_b.sub_bits)
+        for run in (run_a, run_b):
+            for v in run.results.values():
+                v['hist'] = histogram.coarsen(v['hist'], run.sub_bits, sub_bits)
+    rows = {}
+    for name in set(run_a.results) | set(run_b.results):
+        rows[name] = compare_syscall(run_a.results.get(name), run_b.results.get(name), sub_bits)
+    return rows
+
+
+def significant(row, alpha):
+    """
+    Whether a histogram test rejects equal latency at level <alpha>.
+    """
+    return any(p is not None and p < alpha for p in (row['p_mean'], row['p_ks']))
+
+
+def format_compare(rows, alpha):
+    """
+    Render comparisons sorted by absolute change in total time.
+    """
+    def pct(value):
+        return f'{value:+.1%}' if value is not None else 'new'
+    def prob(value):
+        return f'{value:.2g}' if value is not None else '-'
+    lines = []
+    lines.append(f'{"SYSCALL":<22s} {"COUNT_A":>10s} {"COUNT_B":>10s} {"COUNT":>8s} '
+            f'{"MEAN_A(us)":>13s} {"MEAN_B(us)":>13s} {"MEAN":>8s} {"P99":>8s} '
+            f'{"IMPACT(us)":>16s} {"P(MEAN)":>8s} {"KS_D":>6s} {"P(KS)":>8s}')
+    for k, v in sorted(rows.items(), key=lambda r: abs(r[1]['impact']), reverse=True):
+        p99 = pct(v['p99_delta']) if v['p99_delta'] is not None else '-'
+        ks = f'{v["ks"]:.3f}' if v['ks'] is not None else '-'
+        mark = ' *' if significant(v, alpha) else ''
+        lines.append(f'{k:<22s} {v["count_a"]:>10d} {v["count_b"]:>10d} {pct(v["count_delta"]):>8s} '
+                f'{v["mean_a"]:>13.3f} {v["mean_b"]:>13.3f} {pct(v["mean_delta"]):>8s} {p99:>8s} '
+                f'{v["impact"]:>+16.3f} {prob(v["p_mean"]):>8s} {ks:>6s} {prob(v["p_ks"]):>8s}{mark}')
+    return '\n'.join(lines) + '\n'
+
+
+def regressions(rows, alpha, threshold):
+    """
+    Return syscalls whose mean latency grew by more than <threshold>,
+    significantly if the files have histograms to tell.
+    """
+    regressed = []
+    for k, v in rows.items():
+        if v['mean_delta'] is None or v['mean_delta'] <= threshold:
+            continue
+        if v['p_mean'] is not None and not significant(v, alpha):
+            continue
+        regressed.append(k)
+    return sorted(regressed)
+
+
+def compare(args):
+    """
+    Compare two result files and print per-syscall deltas.
+    """
+    try:
+        run_a = load(args.a, args.at)
+        run_b = load(args.b, args.at)
+    except (OSError, ValueError) as e:
+        print(e, file=sys.stderr)
+        sys.exit(-1)
+    if run_a.sub_bits is None or run_b.sub_bits is None:
+        print('Histograms missing, significance needs two --hist time-series files.', file=sys.stderr)
+    rows = compare_runs(run_a, run_b)
+    sys.stdout.write(f'A: {args.a}\nB: {args.b}\n\n')
+    sys.stdout.write(format_compare(rows, args.alpha))
+    if args.fail_above is not None:
+        regressed = regressions(rows, args.alpha, args.fail_above / 100)
+        if regressed:
+            print(f'Regressed by more than {args.fail_above}%: {", ".join(regressed)}', file=sys.stderr)
+            sys.exit(1)
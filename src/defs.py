@@ -24,3 +24,85 @@ PROJECT_PATH = os.path.realpath(os.path.dirname(__file__))
 
 # Path to project/src/bpf
 BPF_PATH = os.path.join(PROJECT_PATH, 'bpf')
+
+# Headers defining system call numbers for each machine, tried in order.
+# {release} is the running kernel, whose headers BCC compiles against.
+SYSCALL_HEADERS = {
+    'x86_64': [
+        '/lib/modules/{release}/build/arch/x86/include/generated/uapi/asm/unistd_64.h',
+        '/usr/include/x86_64-linux-gnu/asm/unistd_64.h',
+        '/usr/include/asm/unistd_64.h',
+    ],
+    # Architectures using the generic system call table
+    'aarch64': [
+        '/lib/modules/{release}/build/include/uapi/asm-generic/unistd.h',
+        '/usr/include/asm-generic/unistd.h',
+    ],
+}
+SYSCALL_HEADERS['riscv64'] = SYSCALL_HEADERS['aarch64']
+SYSCALL_HEADERS['loongarch64'] = SYSCALL_HEADERS['aarch64']
+
+# Indices into the BPF stats map, keep in sync with bpf/bpf_program.c
+STAT_UNMATCHED_ENTER = 0
+STAT_UNMATCHED_EXIT = 1
+STAT_TRACKING_FULL = 2
+STAT_STREAM_DROPPED = 3
+STAT_STACKS_LOST = 4
+NUM_STATS = 5
+
+# Makes the kernel account run time and run count of every BPF program
+BPF_STATS_SYSCTL = '/proc/sys/kernel/bpf_stats_enabled'
+
+# Where tracefs may be mounted, newest first
+TRACEFS_PATHS = ['/sys/kernel/tracing', '/sys/kernel/debug/tracing']
+
+# Largest 1-in-N sampling rate the adaptive controller will pick
+MAX_SAMPLE_RATE = 1 << 16
+
+# Number of log2 latency slots per histogram, keep in sync with
+# hist_index() in bpf/bpf_program.c. Slot n covers [2^(n-1), 2^n) ns.
+HIST_SLOTS = 40
+
+# Values in the BPF targets map, keep in sync with bpf/bpf_program.c
+TARGET_ROOT = 1
+TARGET_CHILD = 2
+TARGET_MATCH = 3
+
+# File descriptor types of I/O calls, indexed like FD_* in bpf/bpf_program.c
+FD_TYPES = ['file', 'socket', 'pipe', 'other']
+
+# Kinds of user page faults, indexed like FAULT_* in bpf/bpf_program.c
+FAULT_TYPES = ['minor', 'major']
+
+# io_uring opcodes indexed like IORING_OP_*, each with the system call doing the
+# same work synchronously, if any. Slots are sized by NUM_URING_OPS in bpf/bpf_program.c
+URING_OPS = [
+    ('nop', None), ('readv', 'preadv'), ('writev', 'pwritev'), ('fsync', 'fsync'),
+    ('read_fixed', 'pread64'), ('write_fixed', 'pwrite64'), ('poll_add', 'poll'),
+    ('poll_remove', None), ('sync_file_range', 'sync_file_range'), ('sendmsg', 'sendmsg'),
+    ('recvmsg', 'recvmsg'), ('timeout', None), ('timeout_remove', None),
+    ('accept', 'accept4'), ('async_cancel', None), ('link_timeout', None),
+    ('connect', 'connect'), ('fallocate', 'fallocate'), ('openat', 'openat'),
+    ('close', 'close'), ('files_update', None), ('statx', 'statx'), ('read', 'pread64'),
+    ('write', 'pwrite64'), ('fadvise', 'fadvise64'), ('madvise', 'madvise'),
+    ('send', 'sendto'), ('recv', 'recvfrom'), ('openat2', 'openat2'),
+    ('epoll_ctl', 'epoll_ctl'), ('splice', 'splice'), ('provide_buffers', None),
+    ('remove_buffers', None), ('tee', 'tee'), ('shutdown', 'shutdown'),
+    ('renameat', 'renameat2'), ('unlinkat', 'unlinkat'), ('mkdirat', 'mkdirat'),
+    ('symlinkat', 'symlinkat'), ('linkat', 'linkat'), ('msg_ring', None),
+    ('fsetxattr', 'fsetxattr'), ('setxattr', 'setxattr'), ('fgetxattr', 'fgetxattr'),
+    ('getxattr', 'getxattr'), ('socket', 'socket'), ('uring_cmd', 'ioctl'),
+    ('send_zc', 'sendto'), ('sendmsg_zc', 'sendmsg'), ('read_multishot', 'read'),
+    ('waitid', 'waitid'), ('futex_wait', 'futex'), ('futex_wake', 'futex'),
+    ('futex_waitv', 'futex_waitv'), ('fixed_fd_install', None), ('ftruncate', 'ftruncate'),
+    ('bind', 'bind'), ('listen', 'listen'),
+]
+NUM_URING_OPS = 64
+
+# Why a trigger fired, indexed like TRIGGER_*_HIT in bpf/bpf_program.c
+TRIGGER_REASONS = {1: 'latency', 2: 'rate'}
+
+# Errno values with their own slot, indexed like errno_slot() in bpf/bpf_program.c
+ERRNO_SLOTS = ['EPERM', 'ENOENT', 'EINTR', 'EBADF', 'ECHILD', 'EAGAIN', 'ENOMEM',
+        'EACCES', 'EEXIST', 'EINVAL', 'ENOTTY', 'EPIPE', 'ECONNRESET', 'ETIMEDOUT',
+        'EINPROGRESS', 'other']
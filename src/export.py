@@ -0,0 +1,244 @@
+# bpfbench  A better benchmarking tool written in eBPF.
+# Copyright (C) 2020  William Findlay
+#
+# Heavily inspired by syscount from bcc-tools:
+# https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import os, sys
+import json
+import struct
+import datetime
+
+from src import histogram, report
+
+# File header: magic, format version, histogram sub-bits (or NO_HIST), length of
+# the JSON metadata that follows
+MAGIC = b'BPFBEXPT'
+VERSION = 1
+HEADER = struct.Struct('<8sIII')
+NO_HIST = 0xffffffff
+
+# Per-row prefix: count, overhead ns, max ns, name length, nonzero buckets.
+# Followed by the name and a (bucket index, count) pair per nonzero bucket.
+ROW = struct.Struct('<QQQHH')
+BUCKET = struct.Struct('<HQ')
+
+
+def metadata(start_time, end_time, clock):
+    """
+    Describe this host and run, in the form merge() combines.
+    """
+    uname = os.uname()
+    return {
+        'hosts': 1,
+        'nodes': {uname.nodename: 1},
+        'kernels': {uname.release: 1},
+        'machines': {uname.machine: 1},
+        'start_time': start_time,
+        'end_time': end_time,
+        'clock': clock,
+    }
+
+
+def write(f, results, meta, sub_bits):
+    """
+    Write cumulative per-syscall <results> with histograms of precision
+    <sub_bits>, or None without histograms.
+    """
+    blob = json.dumps(meta, sort_keys=True).encode('utf-8')
+    f.write(HEADER.pack(MAGIC, VERSION, NO_HIST if sub_bits is None else sub_bits, len(blob)))
+    f.write(blob)
+    buf = bytearray()
+    for name, v in results.items():
+        if not v['count']:
+            continue
+        name = name.encode('utf-8')
+        buckets = [(i, n) for i, n in enumerate(v['hist']) if n] if sub_bits is not None else []
+        buf += ROW.pack(v['count'], round(v['overhead'] * 1e3), round(v['max'] * 1e3),
+                len(name), len(buckets))
+        buf += name
+        for bucket in buckets:
+            buf += BUCKET.pack(*bucket)
+    f.write(buf)
+
+
+def save(path, results, meta, sub_bits):
+    """
+    Replace <path> atomically, so that a merge never reads a partial file.
+    """
+    tmp = f'{path}.tmp'
+    with open(tmp, 'wb') as f:
+        write(f, results, meta, sub_bits)
+    os.replace(tmp, path)
+
+
+def read(path):
+    """
+    Return (metadata, sub_bits, rows) of an export file, sub_bits being None
+    without histograms. Rows are {name: [count, overhead ns, max ns, buckets]}.
+    """
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) < HEADER.size:
+        raise ValueError(f'{path} is not a bpfbench export file.')
+    magic, version, sub_bits, meta_len = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError(f'{path} is not a bpfbench export file.')
+    sub_bits = None if sub_bits == NO_HIST else sub_bits
+    offset = HEADER.size
+    meta = json.loads(data[offset:offset + meta_len].decode('utf-8'))
+    offset += meta_len
+    rows = {}
+    try:
+        while offset < len(data):
+            count, overhead, maximum, name_len, nbuckets = ROW.unpack_from(data, offset)
+            offset += ROW.size
+            name = data[offset:offset + name_len].decode('utf-8')
+            offset += name_len
+            buckets = None
+            if sub_bits is not None:
+                buckets = [0] * histogram.num_buckets(sub_bits)
+                for i, n in BUCKET.iter_unpack(data[offset:offset + nbuckets * BUCKET.size]):
+                    buckets[i] = n
+            offset += nbuckets * BUCKET.size
+            rows[name] = [count, overhead, maximum, buckets]
+    except (struct.error, IndexError):
+        raise ValueError(f'{path} is truncated.')
+    return meta, sub_bits, rows
+
+
+def to_results(rows, sub_bits):
+    """
+    Convert rows into results like get_results.
+    """
+    results = {}
+    for name, (count, overhead, maximum, buckets) in rows.items():
+        results[name] = {
+            'count': count,
+            'overhead': overhead / 1e3,
+            'avg_overhead': overhead / 1e3 / count,
+            'max': maximum / 1e3,
+        }
+        if sub_bits is not None:
+            results[name]['hist'] = buckets
+            results[name].update(histogram.quantiles(buckets, sub_bits, maximum))
+    return results
+
+
+def merge_meta(merged, meta):
+    """
+    Fold the metadata of one more file into <merged>.
+    """
+    merged['hosts'] += meta['hosts']
+    for key in ['nodes', 'kernels', 'machines']:
+        for value, hosts in meta[key].items():
+            merged[key][value] = merged[key].get(value, 0) + hosts
+    merged['start_time'] = min(merged['start_time'], meta['start_time'])
+    merged['end_time'] = max(merged['end_time'], meta['end_time'])
+    if merged['clock'] != meta['clock']:
+        merged['clock'] = 'mixed'
+
+
+def merge_rows(merged, merged_bits, rows, sub_bits):
+    """
+    Add <rows> into <merged> in place and return the precision of the merged
+    histograms: the lowest of the two, or None if either has none.
+    """
+    if merged_bits is not None and sub_bits is not None and sub_bits != merged_bits:
+        to_bits = min(merged_bits, sub_bits)
+        for row in merged.values():
+            row[3] = histogram.coarsen(row[3], merged_bits, to_bits)
+        for row in rows.values():
+            row[3] = histogram.coarsen(row[3], sub_bits, to_bits)
+        merged_bits = to_bits
+    elif merged_bits is None or sub_bits is None:
+        merged_bits = None
+        for row in merged.values():
+            row[3] = None
+    for name, (count, overhead, maximum, buckets) in rows.items():
+        row = merged.get(name)
+        if row is None:
+            merged[name] = [count, overhead, maximum, buckets if merged_bits is not None else None]
+            continue
+        row[0] += count
+        row[1] += overhead
+        row[2] = max(row[2], maximum)
+        if merged_bits is not None:
+            row[3] = [a + b for a, b in zip(row[3], buckets)]
+    return merged_bits
+
+
+def expand(paths):
+    """
+    Yield the files in <paths>, walking directories in name order.
+    """
+    for path in paths:
+        if os.path.isdir(path):
+            for entry in sorted(os.scandir(path), key=lambda e: e.name):
+                if entry.is_file() and not entry.name.endswith('.tmp'):
+                    yield entry.path
+        else:
+            yield path
+
+
+def merge(args):
+    """
+    Combine export files one at a time, so memory only grows with the number
+    of distinct system calls, and write or print the result.
+    """
+    meta, sub_bits, merged = None, None, {}
+    skipped = 0
+    for path in expand(args.files):
+        try:
+            file_meta, file_bits, rows = read(path)
+        except (OSError, ValueError) as e:
+            print(f'Skipping {path}: {e}', file=sys.stderr)
+            skipped += 1
+            continue
+        if meta is None:
+            meta, sub_bits, merged = file_meta, file_bits, rows
+            continue
+        merge_meta(meta, file_meta)
+        sub_bits = merge_rows(merged, sub_bits, rows, file_bits)
+    if meta is None:
+        print(f'No export files to merge.', file=sys.stderr)
+        sys.exit(-1)
+    if skipped and args.strict:
+        sys.exit(-1)
+
+    if sub_bits is None and not args.outfile and args.sort in dict(histogram.QUANTILES):
+        print(f'bpfbench merge: error: Sorting by {args.sort} requires histograms, '
+                f'but some of the files were written without --hist.', file=sys.stderr)
+        sys.exit(2)
+
+    results = to_results(merged, sub_bits)
+    if args.outfile:
+        save(args.outfile, results, meta, sub_bits)
+        return
+    start_time = datetime.datetime.fromtimestamp(meta['start_time'] / 1e9)
+    end_time = datetime.datetime.fromtimestamp(meta['end_time'] / 1e9)
+    kernels = ', '.join(f'{k} ({n})' for k, n in sorted(meta['kernels'].items(),
+            key=lambda k: k[1], reverse=1)[:5])
+    results_str = f'Hosts:        {meta["hosts"]} ({len(meta["nodes"])} distinct)\n'
+    results_str += f'Kernels:      {kernels}\n'
+    results_str += f'First start:  {start_time}\n'
+    results_str += f'Last end:     {end_time}\n'
+    if skipped:
+        results_str += f'Skipped:      {skipped} unreadable files\n'
+    results_str += '\n'
+    results_str += report.format_table(results, args.sort, hist=sub_bits is not None)
+    sys.stdout.write(results_str)
@@ -0,0 +1,88 @@
+# bpfbench  A better benchmarking tool written in eBPF.
+# Copyright (C) 2020  William Findlay
+#
+# Heavily inspired by syscount from bcc-tools:
+# https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+from src import defs
+
+# Quantiles reported alongside each histogram
+QUANTILES = [('p50', 0.5), ('p90', 0.9), ('p99', 0.99), ('p99.9', 0.999)]
+
+def num_buckets(sub_bits):
+    """
+    Number of buckets per histogram for a given sub-bucket precision.
+    """
+    return defs.HIST_SLOTS << sub_bits
+
+def bucket_bounds(index, sub_bits):
+    """
+    Return the [low, high) bounds in ns of bucket <index>.
+    Mirrors hist_index() in bpf/bpf_program.c.
+    """
+    slot = index >> sub_bits
+    sub = index & ((1 << sub_bits) - 1)
+    # Slot 1 also holds zero-length calls
+    if slot <= 1:
+        return 0, 2
+    low = 1 << (slot - 1)
+    if slot > sub_bits:
+        width = 1 << (slot - 1 - sub_bits)
+        low += sub * width
+        return low, low + width
+    return low, low << 1
+
+def coarsen(buckets, sub_bits, to_bits):
+    """
+    Merge linear sub-buckets so that histograms with different precision line up.
+    """
+    if sub_bits == to_bits:
+        return buckets
+    shift = sub_bits - to_bits
+    merged = [0] * num_buckets(to_bits)
+    for index, count in enumerate(buckets):
+        slot, sub = index >> sub_bits, index & ((1 << sub_bits) - 1)
+        merged[(slot << to_bits) | (sub >> shift)] += count
+    return merged
+
+def percentile(buckets, q, sub_bits, maximum=None):
+    """
+    Estimate quantile <q> in ns, interpolating linearly within a bucket.
+    """
+    total = sum(buckets)
+    if not total:
+        return 0.0
+    target = q * total
+    seen = 0
+    for index, count in enumerate(buckets):
+        if not count:
+            continue
+        if seen + count >= target:
+            low, high = bucket_bounds(index, sub_bits)
+            # The last slot is open-ended
+            if maximum is not None and (index >> sub_bits) == defs.HIST_SLOTS - 1:
+                high = max(high, maximum)
+            value = low + (high - low) * (target - seen) / count
+            return min(value, maximum) if maximum is not None else value
+        seen += count
+    return float(maximum) if maximum is not None else 0.0
+
+def quantiles(buckets, sub_bits, maximum=None):
+    """
+    Return {name: value in us} for each of QUANTILES.
+    """
+    return {name: percentile(buckets, q, sub_bits, maximum) / 1e3
+            for name, q in QUANTILES}
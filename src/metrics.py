@@ -0,0 +1,164 @@
+# bpfbench  A better benchmarking tool written in eBPF.
+# Copyright (C) 2020  William Findlay
+#
+# Heavily inspired by syscount from bcc-tools:
+# https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import time
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+from src import histogram
+
+# Prometheus text exposition format
+CONTENT_TYPE = 'text/plain; version=0.0.4; charset=utf-8'
+
+
+def escape(value):
+    """
+    Escape a label value.
+    """
+    return value.replace('\\', '\\\\').replace('"', '\\"').replace('\n', '\\n')
+
+
+def labels(**kwargs):
+    return '{' + ','.join(f'{k}="{escape(str(v))}"' for k, v in kwargs.items()) + '}'
+
+
+def cumulative_buckets(buckets, sub_bits):
+    """
+    Return [(le in seconds, cumulative count)] for a latency histogram.
+    Buckets that share an upper bound (the smallest slots) are merged,
+    and the last, open-ended slot becomes +Inf.
+    """
+    merged = {}
+    seen = 0
+    for index, count in enumerate(buckets[:-1]):
+        seen += count
+        merged[histogram.bucket_bounds(index, sub_bits)[1] / 1e9] = seen
+    return list(merged.items()) + [('+Inf', seen + buckets[-1])]
+
+
+def exposition(results, stats, sub_bits=None, sample_rate=None, runq_sub_bits=0):
+    """
+    Render cumulative per-syscall results as Prometheus metrics.
+    """
+    lines = []
+    def family(name, kind, text):
+        lines.append(f'# HELP {name} {text}')
+        lines.append(f'# TYPE {name} {kind}')
+
+    family('bpfbench_syscall_calls_total', 'counter', 'System calls that returned.')
+    for k, v in results.items():
+        lines.append(f'bpfbench_syscall_calls_total{labels(syscall=k)} {v["count"]}')
+
+    if sub_bits is None:
+        family('bpfbench_syscall_latency_seconds_total', 'counter', 'Time spent in system calls.')
+        for k, v in results.items():
+            lines.append(f'bpfbench_syscall_latency_seconds_total{labels(syscall=k)} {v["overhead"] / 1e6!r}')
+    else:
+        family('bpfbench_syscall_latency_seconds', 'histogram', 'System call latency.')
+        for k, v in results.items():
+            for le, count in cumulative_buckets(v['hist'], sub_bits):
+                lines.append(f'bpfbench_syscall_latency_seconds_bucket{labels(syscall=k, le=le)} {count}')
+            lines.append(f'bpfbench_syscall_latency_seconds_sum{labels(syscall=k)} {v["overhead"] / 1e6!r}')
+            lines.append(f'bpfbench_syscall_latency_seconds_count{labels(syscall=k)} {v["count"]}')
+
+    if any('offcpu' in v for v in results.values()):
+        family('bpfbench_syscall_offcpu_seconds_total', 'counter', 'Time system calls spent switched out.')
+        for k, v in results.items():
+            lines.append(f'bpfbench_syscall_offcpu_seconds_total{labels(syscall=k)} {v["offcpu"] / 1e6!r}')
+
+    if any('runq' in v for v in results.values()):
+        family('bpfbench_syscall_runq_latency_seconds', 'histogram',
+                'Run queue waits of threads inside system calls.')
+        for k, v in results.items():
+            runq = v['runq']
+            for le, count in cumulative_buckets(runq['hist'], runq_sub_bits):
+                lines.append(f'bpfbench_syscall_runq_latency_seconds_bucket{labels(syscall=k, le=le)} {count}')
+            lines.append(f'bpfbench_syscall_runq_latency_seconds_sum{labels(syscall=k)} {runq["overhead"] / 1e6!r}')
+            lines.append(f'bpfbench_syscall_runq_latency_seconds_count{labels(syscall=k)} {runq["count"]}')
+
+    if any('errnos' in v for v in results.values()):
+        family('bpfbench_syscall_errors_total', 'counter', 'System calls that returned an errno.')
+        for k, v in results.items():
+            for errno, count in v['errnos'].items():
+                lines.append(f'bpfbench_syscall_errors_total{labels(syscall=k, errno=errno)} {count}')
+
+    if any('io' in v for v in results.values()):
+        family('bpfbench_syscall_io_bytes_total', 'counter', 'Bytes returned by I/O system calls.')
+        for k, v in results.items():
+            for fd_type, e in v.get('io', {}).items():
+                lines.append(f'bpfbench_syscall_io_bytes_total{labels(syscall=k, fd=fd_type)} {e["bytes"]}')
+
+    family('bpfbench_unmatched_total', 'counter', 'System call enters and exits that could not be matched.')
+    lines.append(f'bpfbench_unmatched_total {stats["unmatched"]}')
+    family('bpfbench_dropped_total', 'counter', 'System calls not timed because the in-flight map was full.')
+    lines.append(f'bpfbench_dropped_total {stats["dropped"]}')
+    if sample_rate:
+        family('bpfbench_sample_rate', 'gauge', 'Current 1-in-N sampling rate per CPU.')
+        lines.append(f'bpfbench_sample_rate {sample_rate}')
+
+    return '\n'.join(lines) + '\n'
+
+
+class MetricsServer:
+    """
+    Serve /metrics from a daemon thread.
+    Maps are only read when scraped, and at most once per <ttl> seconds.
+    """
+
+    def __init__(self, address, port, collect, ttl):
+        self.collect = collect
+        self.ttl = ttl
+        self.cache = None
+        self.cache_time = 0
+        self.lock = threading.Lock()
+        server = self
+
+        class Handler(BaseHTTPRequestHandler):
+            def do_GET(self):
+                if self.path.split('?')[0] != '/metrics':
+                    self.send_error(404)
+                    return
+                body = server.scrape()
+                self.send_response(200)
+                self.send_header('Content-Type', CONTENT_TYPE)
+                self.send_header('Content-Length', str(len(body)))
+                self.end_headers()
+                self.wfile.write(body)
+
+            def log_message(self, format, *args):
+                pass
+
+        self.httpd = ThreadingHTTPServer((address, port), Handler)
+        self.thread = threading.Thread(target=self.httpd.serve_forever)
+        self.thread.setDaemon(1)
+
+    def start(self):
+        self.thread.start()
+
+    def scrape(self):
+        """
+        Return the cached exposition, refreshing it if it is older than the TTL.
+        """
+        with self.lock:
+            now = time.monotonic()
+            if self.cache is None or now - self.cache_time >= self.ttl:
+                self.cache = self.collect().encode('utf-8')
+                self.cache_time = now
+            return self.cache
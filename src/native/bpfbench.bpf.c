@@ -0,0 +1,302 @@
+/* bpfbench  A better benchmarking tool written in eBPF.
+ * Copyright (C) 2020  William Findlay
+ *
+ * Heavily inspired by syscount from bcc-tools:
+ * https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+/* CO-RE port of src/bpf/bpf_program.c for the native collector.
+ * Options that the BCC version compiles in with -D are read-only globals
+ * here, set by bpfbench.c before load, so the verifier still prunes them. */
+
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_core_read.h>
+
+#include "bpfbench.h"
+
+#define ERESTARTSYS           512
+#define ERESTARTNOINTR        513
+#define ERESTARTNOHAND        514
+#define ERESTART_RESTARTBLOCK 516
+
+char LICENSE[] SEC("license") = "GPL";
+
+/* configuration below this line -------------------------------------------- */
+
+const volatile u32 bpfbench_pid = 0;
+const volatile u32 trace_pid = 0;
+const volatile bool follow = false;
+const volatile long restart_syscall_nr = -1;
+const volatile bool histogram = false;
+const volatile u32 hist_sub_bits = 0;
+const volatile bool filter_syscalls = false;
+const volatile u64 syscall_allowed[MAX_SYSCALLS / 64] = {};
+
+/* maps below this line ----------------------------------------------------- */
+
+/* max_entries of intermediate, syscalls and hists are set at load time */
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 65536);
+    __type(key, u32);
+    __type(value, struct intermediate_t);
+} intermediate SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, MAX_SYSCALLS);
+    __type(key, u32);
+    __type(value, struct data_t);
+} syscalls SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, NUM_STATS);
+    __type(key, u32);
+    __type(value, u64);
+} stats SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, u32);
+    __type(value, u64);
+} hists SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 10240);
+    __type(key, u32);
+    __type(value, u8);
+} children SEC(".maps");
+
+/* helpers below this line -------------------------------------------------- */
+
+static __always_inline void stat_increment(u32 stat)
+{
+    u64 *val = bpf_map_lookup_elem(&stats, &stat);
+    if (val) {
+        (*val)++;
+    }
+}
+
+static __always_inline bool syscall_filtered(long syscall)
+{
+    if (!filter_syscalls) {
+        return false;
+    }
+    if (syscall < 0 || syscall >= MAX_SYSCALLS) {
+        return true;
+    }
+    return !((syscall_allowed[syscall >> 6] >> (syscall & 63)) & 1);
+}
+
+static __always_inline bool pid_filtered(u64 pid_tgid)
+{
+    u32 pid = pid_tgid >> 32;
+
+    /* Don't trace self */
+    if (pid == bpfbench_pid) {
+        return true;
+    }
+    if (!trace_pid || pid == trace_pid) {
+        return false;
+    }
+    return !follow || !bpf_map_lookup_elem(&children, &pid);
+}
+
+/* floor(log2(v)) + 1, with zero sharing slot 1, as bcc's bpf_log2l() */
+static __always_inline u32 log2_32(u32 v)
+{
+    u32 r, shift;
+
+    r = (v > 0xFFFF) << 4; v >>= r;
+    shift = (v > 0xFF) << 3; v >>= shift; r |= shift;
+    shift = (v > 0xF) << 2; v >>= shift; r |= shift;
+    shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+    r |= (v >> 1);
+    return r;
+}
+
+static __always_inline u32 log2_64(u64 v)
+{
+    u32 hi = v >> 32;
+    return hi ? log2_32(hi) + 33 : log2_32(v) + 1;
+}
+
+/* Map a latency in ns to its bucket, mirrored by src/histogram.py */
+static __always_inline u32 hist_index(u64 value)
+{
+    u32 slot = log2_64(value);
+    u32 sub = 0;
+
+    if (hist_sub_bits && slot > hist_sub_bits) {
+        sub = (value >> (slot - 1 - hist_sub_bits)) & ((1 << hist_sub_bits) - 1);
+    }
+
+    /* Clamp outliers into the last bucket */
+    if (slot >= HIST_SLOTS) {
+        slot = HIST_SLOTS - 1;
+        sub = (1 << hist_sub_bits) - 1;
+    }
+
+    return (slot << hist_sub_bits) + sub;
+}
+
+/* bpf programs below this line --------------------------------------------- */
+
+SEC("raw_tracepoint/sched_process_fork")
+int sched_process_fork(struct bpf_raw_tracepoint_args *ctx)
+{
+    struct task_struct *p = (struct task_struct *)ctx->args[0];
+    struct task_struct *c = (struct task_struct *)ctx->args[1];
+
+    if (!follow) {
+        return 0;
+    }
+
+    u32 ppid = BPF_CORE_READ(p, tgid);
+
+    /* Filter ppid */
+    if (ppid != trace_pid && !bpf_map_lookup_elem(&children, &ppid)) {
+        return 0;
+    }
+
+    u32 cpid = BPF_CORE_READ(c, tgid);
+    u8 zero = 0;
+
+    bpf_map_update_elem(&children, &cpid, &zero, BPF_ANY);
+
+    return 0;
+}
+
+SEC("raw_tracepoint/sched_process_exit")
+int sched_process_exit(struct bpf_raw_tracepoint_args *ctx)
+{
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+
+    /* Release the exiting thread's in-flight slot */
+    u32 tid = pid_tgid;
+    bpf_map_delete_elem(&intermediate, &tid);
+
+    if (follow) {
+        u32 pid = pid_tgid >> 32;
+        bpf_map_delete_elem(&children, &pid);
+    }
+
+    return 0;
+}
+
+SEC("raw_tracepoint/sys_enter")
+int sys_enter(struct bpf_raw_tracepoint_args *ctx)
+{
+    long syscall = ctx->args[1];
+
+    /* Return before touching the clock or any map */
+    if (syscall_filtered(syscall)) {
+        return 0;
+    }
+
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+    if (pid_filtered(pid_tgid)) {
+        return 0;
+    }
+
+    u32 tid = pid_tgid;
+    struct intermediate_t *start = bpf_map_lookup_elem(&intermediate, &tid);
+    if (start) {
+        /* The previous call never returned (e.g. exit or a lost sys_exit) */
+        if (start->start_time) {
+            stat_increment(STAT_UNMATCHED_ENTER);
+        }
+        start->sysnum = syscall;
+        start->start_time = bpf_ktime_get_ns();
+        return 0;
+    }
+
+    /* First system call for this thread */
+    struct intermediate_t new_start = {};
+    new_start.sysnum = syscall;
+    new_start.start_time = bpf_ktime_get_ns();
+    if (bpf_map_update_elem(&intermediate, &tid, &new_start, BPF_NOEXIST)) {
+        stat_increment(STAT_TRACKING_FULL);
+    }
+
+    return 0;
+}
+
+SEC("raw_tracepoint/sys_exit")
+int sys_exit(struct bpf_raw_tracepoint_args *ctx)
+{
+    long ret = ctx->args[1];
+    u64 pid_tgid = bpf_get_current_pid_tgid();
+
+    if (pid_filtered(pid_tgid)) {
+        return 0;
+    }
+
+    /* The syscall id is the one saved at sys_enter, which needs no
+     * architecture-specific pt_regs access */
+    u32 tid = pid_tgid;
+    struct intermediate_t *start = bpf_map_lookup_elem(&intermediate, &tid);
+    if (!start || !start->start_time) {
+        /* Filtered syscalls never create an entry, so only count
+         * unmatched exits when every syscall is traced */
+        if (!filter_syscalls) {
+            stat_increment(STAT_UNMATCHED_EXIT);
+        }
+        return 0;
+    }
+    /* Untimed calls, e.g. outside --syscalls, never read the clock */
+    u64 curr_time = bpf_ktime_get_ns();
+    u64 start_time = start->start_time;
+    u32 syscall = start->sysnum;
+    start->start_time = 0;
+
+    /* Discard restarted syscalls due to system suspend */
+    if (syscall == restart_syscall_nr) {
+        return 0;
+    }
+
+    /* Ignore system calls that would restart */
+    if (ret == -ERESTARTSYS || ret == -ERESTARTNOHAND ||
+        ret == -ERESTARTNOINTR || ret == -ERESTART_RESTARTBLOCK) {
+        return 0;
+    }
+
+    u64 delta = curr_time - start_time;
+
+    struct data_t *data = bpf_map_lookup_elem(&syscalls, &syscall);
+    if (!data) {
+        return 0;
+    }
+    data->count++;
+    data->overhead += delta;
+    if (delta > data->max) {
+        data->max = delta;
+    }
+
+    if (histogram) {
+        u32 index = (syscall * HIST_SLOTS << hist_sub_bits) + hist_index(delta);
+        u64 *bucket = bpf_map_lookup_elem(&hists, &index);
+        if (bucket) {
+            (*bucket)++;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,1084 @@
+/* bpfbench  A better benchmarking tool written in eBPF.
+ * Copyright (C) 2020  William Findlay
+ *
+ * Heavily inspired by syscount from bcc-tools:
+ * https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+/* Native collector: loads the precompiled CO-RE object bpfbench.bpf.o
+ * through its libbpf skeleton instead of compiling with BCC at startup.
+ * Supports the same options and outfile formats as src/parse_args.py,
+ * except for breakdown and streaming modes. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <grp.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "bpfbench.h"
+#include "bpfbench.skel.h"
+#include "syscall_names.h"
+
+#define NUM_SYSCALLS (sizeof(syscall_names) / sizeof(*syscall_names))
+
+/* Time-series outfile layout, keep in sync with src/timeseries.py */
+#define TS_MAGIC "BPFBTSER"
+#define TS_VERSION 1
+
+struct ts_header {
+    char magic[8];
+    __u32 version;
+    __u32 nbuckets;
+    __u32 sub_bits;
+    __u32 names_len;
+    __u64 start_time;
+} __attribute__((packed));
+
+struct ts_row {
+    __u64 timestamp;
+    __u32 sysnum;
+    __u32 __pad;
+    __u64 count;
+    __u64 overhead;
+    __u64 max;
+} __attribute__((packed));
+
+static const char *sort_choices[] = {
+    "sysname", "sysnum", "count", "overhead", "avg_overhead",
+    "p50", "p90", "p99", "p99.9", "max", NULL,
+};
+
+/* Quantiles reported alongside each histogram, as src/histogram.py */
+static const char *quantile_names[] = { "P50", "P90", "P99", "P99.9" };
+static const double quantile_values[] = { 0.5, 0.9, 0.99, 0.999 };
+#define NUM_QUANTILES 4
+
+struct options {
+    long duration;   /* seconds, 0 means forever */
+    long checkpoint; /* seconds */
+    bool interval;
+    const char *outfile;
+    bool overwrite;
+    bool tee;
+    const char *sort;
+    bool sysnum;
+    bool hist;
+    unsigned int hist_sub_bits;
+    bool timeseries;
+    __u64 syscall_allowed[MAX_SYSCALLS / 64];
+    bool filter_syscalls;
+    char **run;
+    pid_t pid;
+    bool follow;
+    unsigned int max_threads;
+};
+
+struct result {
+    __u32 sysnum;
+    __u64 count;
+    __u64 overhead; /* ns */
+    __u64 max;      /* ns */
+    __u64 *hist;
+    double quantiles[NUM_QUANTILES]; /* ns */
+};
+
+static struct options opts = {
+    .checkpoint = 30 * 60,
+    .max_threads = 65536,
+};
+
+static struct bpfbench_bpf *skel;
+static int ncpus;
+static unsigned int nbuckets;
+static struct timeval start_time;
+static struct timespec last_interval;
+static volatile sig_atomic_t should_exit;
+
+/* Previous cumulative results for --interval, indexed by sysnum */
+static struct result *prev_results;
+static struct result *results;
+static __u64 *percpu_buf;
+static FILE *timeseries;
+
+/* time helpers below this line --------------------------------------------- */
+
+/* Parse a duration like timeout(1): #[s] #m #h #d #w */
+static int parse_time(const char *arg, long *seconds)
+{
+    char *end;
+    long value;
+
+    errno = 0;
+    value = strtol(arg, &end, 10);
+    if (errno || end == arg || value < 0) {
+        return -1;
+    }
+    if (!*end || ((*end == 's' || *end == 'S') && !end[1])) {
+        *seconds = value;
+        return 0;
+    }
+    if (end[1]) {
+        return -1;
+    }
+    switch (*end) {
+    case 'm': case 'M': *seconds = value * 60; return 0;
+    case 'h': case 'H': *seconds = value * 60 * 60; return 0;
+    case 'd': case 'D': *seconds = value * 60 * 60 * 24; return 0;
+    case 'w': case 'W': *seconds = value * 60 * 60 * 24 * 7; return 0;
+    }
+    return -1;
+}
+
+/* Print like Python's datetime.__str__ */
+static void format_datetime(const struct timeval *tv, char *buf, size_t len)
+{
+    struct tm tm;
+    size_t n;
+
+    localtime_r(&tv->tv_sec, &tm);
+    n = strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm);
+    if (tv->tv_usec && n < len) {
+        snprintf(buf + n, len - n, ".%06ld", (long)tv->tv_usec);
+    }
+}
+
+/* Print like Python's timedelta.__str__ */
+static void format_timedelta(long long usec, char *buf, size_t len)
+{
+    long long secs = usec / 1000000;
+    long long days = secs / 86400;
+    int n = 0;
+
+    if (days) {
+        n = snprintf(buf, len, "%lld day%s, ", days, days == 1 ? "" : "s");
+    }
+    n += snprintf(buf + n, len - n, "%lld:%02lld:%02lld", (secs % 86400) / 3600,
+                  (secs % 3600) / 60, secs % 60);
+    if (usec % 1000000) {
+        snprintf(buf + n, len - n, ".%06lld", usec % 1000000);
+    }
+}
+
+static long long elapsed_usec(const struct timeval *from, const struct timeval *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000000LL + (to->tv_usec - from->tv_usec);
+}
+
+/* privilege helpers below this line ---------------------------------------- */
+
+static int sudo_ids(uid_t *uid, gid_t *gid)
+{
+    const char *suid = getenv("SUDO_UID");
+    const char *sgid = getenv("SUDO_GID");
+
+    if (!suid || !sgid) {
+        return -1;
+    }
+    *uid = strtoul(suid, NULL, 10);
+    *gid = strtoul(sgid, NULL, 10);
+    return 0;
+}
+
+/* Open <path> as the sudoer, we never write files as root */
+static FILE *fopen_as_user(const char *path, const char *mode)
+{
+    uid_t uid;
+    gid_t gid;
+    FILE *f;
+
+    if (sudo_ids(&uid, &gid)) {
+        fprintf(stderr, "Could not get UID/GID for sudoer\n");
+        return NULL;
+    }
+    if (setegid(gid) || seteuid(uid)) {
+        return NULL;
+    }
+    f = fopen(path, mode);
+    if (seteuid(0) || setegid(0)) {
+        fprintf(stderr, "Unable to regain root privileges\n");
+        exit(-1);
+    }
+    return f;
+}
+
+/* histogram helpers below this line ---------------------------------------- */
+
+/* [low, high) bounds in ns of bucket <index>, as src/histogram.py */
+static void bucket_bounds(unsigned int index, unsigned int sub_bits,
+                          double *low, double *high)
+{
+    unsigned int slot = index >> sub_bits;
+    unsigned int sub = index & ((1 << sub_bits) - 1);
+
+    /* Slot 1 also holds zero-length calls */
+    if (slot <= 1) {
+        *low = 0;
+        *high = 2;
+        return;
+    }
+    *low = (double)(1ULL << (slot - 1));
+    if (slot > sub_bits) {
+        double width = (double)(1ULL << (slot - 1 - sub_bits));
+        *low += sub * width;
+        *high = *low + width;
+        return;
+    }
+    *high = *low * 2;
+}
+
+static double percentile(const __u64 *buckets, double q, __u64 maximum)
+{
+    __u64 total = 0, seen = 0;
+    unsigned int i;
+
+    for (i = 0; i < nbuckets; i++) {
+        total += buckets[i];
+    }
+    if (!total) {
+        return 0;
+    }
+    double target = q * total;
+    for (i = 0; i < nbuckets; i++) {
+        if (!buckets[i]) {
+            continue;
+        }
+        if (seen + buckets[i] >= target) {
+            double low, high;
+            bucket_bounds(i, opts.hist_sub_bits, &low, &high);
+            /* The last slot is open-ended */
+            if ((i >> opts.hist_sub_bits) == HIST_SLOTS - 1 && maximum > high) {
+                high = maximum;
+            }
+            double value = low + (high - low) * (target - seen) / buckets[i];
+            return value < maximum ? value : maximum;
+        }
+        seen += buckets[i];
+    }
+    return maximum;
+}
+
+/* results below this line -------------------------------------------------- */
+
+static int read_histogram(__u32 sysnum, __u64 *out)
+{
+    int fd = bpf_map__fd(skel->maps.hists);
+
+    for (unsigned int i = 0; i < nbuckets; i++) {
+        __u32 key = sysnum * nbuckets + i;
+        out[i] = 0;
+        if (bpf_map_lookup_elem(fd, &key, percpu_buf)) {
+            return -1;
+        }
+        for (int cpu = 0; cpu < ncpus; cpu++) {
+            out[i] += percpu_buf[cpu];
+        }
+    }
+    return 0;
+}
+
+/* Read cumulative results into results[], returns the number of active syscalls */
+static int get_results(void)
+{
+    int fd = bpf_map__fd(skel->maps.syscalls);
+    struct data_t *values = (struct data_t *)percpu_buf;
+    int active = 0;
+
+    for (__u32 sysnum = 0; sysnum < NUM_SYSCALLS; sysnum++) {
+        struct result *r = &results[sysnum];
+
+        r->sysnum = sysnum;
+        r->count = r->overhead = r->max = 0;
+        if (bpf_map_lookup_elem(fd, &sysnum, values)) {
+            continue;
+        }
+        for (int cpu = 0; cpu < ncpus; cpu++) {
+            r->count += values[cpu].count;
+            r->overhead += values[cpu].overhead;
+            if (values[cpu].max > r->max) {
+                r->max = values[cpu].max;
+            }
+        }
+        if (r->count) {
+            active++;
+        }
+        if (opts.hist && r->count) {
+            read_histogram(sysnum, r->hist);
+        }
+    }
+    return active;
+}
+
+static const char *syscall_name(__u32 sysnum)
+{
+    static char unknown[32];
+
+    if (sysnum < NUM_SYSCALLS && syscall_names[sysnum]) {
+        return syscall_names[sysnum];
+    }
+    snprintf(unknown, sizeof(unknown), "[unknown: %u]", sysnum);
+    return unknown;
+}
+
+static double sort_value(const struct result *r)
+{
+    if (!strcmp(opts.sort, "sysnum"))
+        return r->sysnum;
+    if (!strcmp(opts.sort, "count"))
+        return r->count;
+    if (!strcmp(opts.sort, "overhead"))
+        return r->overhead;
+    if (!strcmp(opts.sort, "max"))
+        return r->max;
+    for (int i = 0; i < NUM_QUANTILES; i++) {
+        if (!strcasecmp(opts.sort, quantile_names[i]))
+            return r->quantiles[i];
+    }
+    return (double)r->overhead / r->count;
+}
+
+static int compare_results(const void *a, const void *b)
+{
+    const struct result *ra = *(const struct result **)a;
+    const struct result *rb = *(const struct result **)b;
+
+    if (!strcmp(opts.sort, "sysname")) {
+        char name[32];
+        /* syscall_name() may return a static buffer */
+        snprintf(name, sizeof(name), "%s", syscall_name(ra->sysnum));
+        return strcmp(name, syscall_name(rb->sysnum));
+    }
+    double va = sort_value(ra), vb = sort_value(rb);
+    /* Everything but sysname and sysnum sorts in descending order */
+    if (!strcmp(opts.sort, "sysnum")) {
+        return (va > vb) - (va < vb);
+    }
+    return (va < vb) - (va > vb);
+}
+
+static __u64 get_stat(int fd, __u32 stat)
+{
+    __u64 total = 0;
+
+    if (bpf_map_lookup_elem(fd, &stat, percpu_buf)) {
+        return 0;
+    }
+    for (int cpu = 0; cpu < ncpus; cpu++) {
+        total += percpu_buf[cpu];
+    }
+    return total;
+}
+
+static void write_timeseries(void)
+{
+    size_t row_size = sizeof(struct ts_row) + nbuckets * sizeof(__u64);
+    static char *buf;
+    size_t len = 0;
+    struct timespec now;
+
+    if (!buf && !(buf = malloc(row_size * NUM_SYSCALLS))) {
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    for (__u32 sysnum = 0; sysnum < NUM_SYSCALLS; sysnum++) {
+        struct result *r = &results[sysnum];
+        struct ts_row row = {
+            .timestamp = now.tv_sec * 1000000000ULL + now.tv_nsec,
+            .sysnum = sysnum,
+            .count = r->count,
+            .overhead = r->overhead,
+            .max = r->max,
+        };
+
+        if (!r->count) {
+            continue;
+        }
+        memcpy(buf + len, &row, sizeof(row));
+        if (nbuckets) {
+            memcpy(buf + len + sizeof(row), r->hist, nbuckets * sizeof(__u64));
+        }
+        len += row_size;
+    }
+    fwrite(buf, 1, len, timeseries);
+    fflush(timeseries);
+}
+
+/* Turn results[] into deltas since the last call, returns the interval in seconds */
+static double apply_interval(void)
+{
+    struct timespec now;
+    double elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - last_interval.tv_sec) +
+              (now.tv_nsec - last_interval.tv_nsec) / 1e9;
+    last_interval = now;
+    for (__u32 sysnum = 0; sysnum < NUM_SYSCALLS; sysnum++) {
+        struct result *r = &results[sysnum], *prev = &prev_results[sysnum];
+        __u64 count = r->count, overhead = r->overhead;
+
+        r->count -= prev->count;
+        r->overhead -= prev->overhead;
+        prev->count = count;
+        prev->overhead = overhead;
+        for (unsigned int i = 0; i < nbuckets; i++) {
+            __u64 bucket = r->hist[i];
+            r->hist[i] -= prev->hist[i];
+            prev->hist[i] = bucket;
+        }
+    }
+    return elapsed > 1e-9 ? elapsed : 1e-9;
+}
+
+static void format_results(FILE *f, bool interval, double elapsed)
+{
+    struct result *sorted[NUM_SYSCALLS];
+    int stats_fd = bpf_map__fd(skel->maps.stats);
+    struct timeval now;
+    char buf[64];
+    int n = 0;
+
+    gettimeofday(&now, NULL);
+    format_datetime(&start_time, buf, sizeof(buf));
+    fprintf(f, "Start time:   %s\n", buf);
+    format_datetime(&now, buf, sizeof(buf));
+    fprintf(f, "Current time: %s\n", buf);
+    format_timedelta(elapsed_usec(&start_time, &now), buf, sizeof(buf));
+    fprintf(f, "Time elapsed: %s\n", buf);
+    if (interval) {
+        format_timedelta((long long)(elapsed * 1e6), buf, sizeof(buf));
+        fprintf(f, "Interval:     %s\n", buf);
+    }
+    fprintf(f, "Unmatched:    %llu enter/exit pairs\n",
+            (unsigned long long)(get_stat(stats_fd, STAT_UNMATCHED_ENTER) +
+                                 get_stat(stats_fd, STAT_UNMATCHED_EXIT)));
+    __u64 dropped = get_stat(stats_fd, STAT_TRACKING_FULL);
+    if (dropped) {
+        fprintf(f, "Dropped:      %llu calls (raise --max-threads)\n",
+                (unsigned long long)dropped);
+    }
+    fprintf(f, "\n");
+
+    /* Add header */
+    if (opts.sysnum) {
+        fprintf(f, "%-3s ", "NUM");
+    }
+    fprintf(f, "%-22s %8s %22s %22s", "SYSCALL", "COUNT", "OVERHEAD(us)",
+            "AVG_OVERHEAD(us/call)");
+    if (opts.hist) {
+        for (int i = 0; i < NUM_QUANTILES; i++) {
+            snprintf(buf, sizeof(buf), "%s(us)", quantile_names[i]);
+            fprintf(f, " %13s", buf);
+        }
+        fprintf(f, " %13s", "MAX(us)");
+    }
+    if (interval) {
+        fprintf(f, " %13s %13s", "CALLS/s", "US/s");
+    }
+    fprintf(f, "\n");
+
+    /* Add results */
+    for (__u32 sysnum = 0; sysnum < NUM_SYSCALLS; sysnum++) {
+        struct result *r = &results[sysnum];
+        if (!r->count) {
+            continue;
+        }
+        for (int i = 0; opts.hist && i < NUM_QUANTILES; i++) {
+            r->quantiles[i] = percentile(r->hist, quantile_values[i], r->max);
+        }
+        sorted[n++] = r;
+    }
+    qsort(sorted, n, sizeof(*sorted), compare_results);
+    for (int i = 0; i < n; i++) {
+        struct result *r = sorted[i];
+        double overhead = r->overhead / 1e3;
+
+        if (opts.sysnum) {
+            fprintf(f, "%-3u ", r->sysnum);
+        }
+        fprintf(f, "%-22s %8llu %22.3f%22.3f", syscall_name(r->sysnum),
+                (unsigned long long)r->count, overhead, overhead / r->count);
+        if (opts.hist) {
+            for (int q = 0; q < NUM_QUANTILES; q++) {
+                fprintf(f, " %13.3f", r->quantiles[q] / 1e3);
+            }
+            fprintf(f, " %13.3f", r->max / 1e3);
+        }
+        if (interval) {
+            fprintf(f, " %13.3f %13.3f", r->count / elapsed, overhead / elapsed);
+        }
+        fprintf(f, "\n");
+    }
+    fprintf(f, "\n");
+}
+
+static void save_results(void)
+{
+    double elapsed = 0;
+    FILE *f = stderr;
+
+    get_results();
+    if (timeseries) {
+        write_timeseries();
+    }
+    if (opts.interval) {
+        elapsed = apply_interval();
+    }
+    if (timeseries) {
+        /* Rows are already appended, the text table only goes to stderr */
+        if (opts.tee) {
+            format_results(stderr, opts.interval, elapsed);
+        }
+        return;
+    }
+    if (opts.outfile && !(f = fopen_as_user(opts.outfile, "w"))) {
+        fprintf(stderr, "Unable to open %s: %s\n", opts.outfile, strerror(errno));
+        return;
+    }
+    format_results(f, opts.interval, elapsed);
+    if (opts.tee) {
+        format_results(stderr, opts.interval, elapsed);
+    }
+    if (opts.outfile) {
+        fclose(f);
+    }
+}
+
+static int open_timeseries(void)
+{
+    struct ts_header header = {
+        .version = TS_VERSION,
+        .nbuckets = nbuckets,
+        .sub_bits = opts.hist_sub_bits,
+        .start_time = start_time.tv_sec * 1000000000ULL + start_time.tv_usec * 1000ULL,
+    };
+
+    if (!(timeseries = fopen_as_user(opts.outfile, "wb"))) {
+        fprintf(stderr, "Unable to open %s: %s\n", opts.outfile, strerror(errno));
+        return -1;
+    }
+    memcpy(header.magic, TS_MAGIC, sizeof(header.magic));
+    for (__u32 sysnum = 0; sysnum < NUM_SYSCALLS; sysnum++) {
+        header.names_len += strlen(syscall_name(sysnum)) + (sysnum ? 1 : 0);
+    }
+    fwrite(&header, sizeof(header), 1, timeseries);
+    for (__u32 sysnum = 0; sysnum < NUM_SYSCALLS; sysnum++) {
+        if (sysnum) {
+            fputc('\0', timeseries);
+        }
+        fputs(syscall_name(sysnum), timeseries);
+    }
+    fflush(timeseries);
+    return 0;
+}
+
+/* argument parsing below this line ----------------------------------------- */
+
+static void usage(FILE *f)
+{
+    fprintf(f,
+"usage: bpfbench-native [-h] [-d DURATION [DURATION ...]] [-c CHECKPOINT [CHECKPOINT ...]]\n"
+"                       [-i] [-o OUTFILE] [--overwrite] [--tee] [--sort KEY] [--sysnum]\n"
+"                       [--hist] [--hist-sub-bits N] [--format {text,timeseries}]\n"
+"                       [--syscalls list] [--max-threads N] [-r prog ... | -p pid] [-f]\n"
+"\n"
+"bpfbench\n"
+"    System benchmarking with eBPF.\n"
+"    Native libbpf collector, see bpfbench --help for option details.\n"
+"    Breakdown, streaming and runtime filtering need the BCC collector.\n");
+}
+
+/* Sort keys after avg_overhead come from histograms */
+static bool sort_needs_hist(const char *sort)
+{
+    for (int i = 5; sort_choices[i]; i++) {
+        if (!strcmp(sort, sort_choices[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void parse_error(const char *fmt, const char *arg)
+{
+    usage(stderr);
+    fprintf(stderr, "bpfbench-native: error: ");
+    fprintf(stderr, fmt, arg);
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+/* Consume one or more time values, e.g. "-d 1m 30s" */
+static long parse_times(int argc, char **argv, const char *first)
+{
+    long total = 0, value;
+
+    if (parse_time(first, &value)) {
+        parse_error("Invalid specification for time \"%s\".", first);
+    }
+    total += value;
+    while (optind < argc && !parse_time(argv[optind], &value)) {
+        total += value;
+        optind++;
+    }
+    return total;
+}
+
+static void parse_syscalls(const char *arg)
+{
+    char *list = strdup(arg), *save, *name;
+
+    for (name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+        long num = -1;
+        char *end;
+
+        num = strtol(name, &end, 10);
+        if (*end || end == name) {
+            num = -1;
+            for (__u32 i = 0; i < NUM_SYSCALLS; i++) {
+                if (syscall_names[i] && !strcmp(syscall_names[i], name)) {
+                    num = i;
+                    break;
+                }
+            }
+        }
+        if (num < 0 || num >= MAX_SYSCALLS) {
+            parse_error("Unknown system call \"%s\".", name);
+        }
+        opts.syscall_allowed[num >> 6] |= 1ULL << (num & 63);
+        opts.filter_syscalls = true;
+    }
+    free(list);
+}
+
+enum {
+    OPT_OVERWRITE = 256,
+    OPT_TEE,
+    OPT_SORT,
+    OPT_SYSNUM,
+    OPT_HIST,
+    OPT_HIST_SUB_BITS,
+    OPT_FORMAT,
+    OPT_SYSCALLS,
+    OPT_MAX_THREADS,
+    OPT_UNSUPPORTED,
+};
+
+static void parse_args(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "help", no_argument, NULL, 'h' },
+        { "duration", required_argument, NULL, 'd' },
+        { "checkpoint", required_argument, NULL, 'c' },
+        { "interval", no_argument, NULL, 'i' },
+        { "outfile", required_argument, NULL, 'o' },
+        { "overwrite", no_argument, NULL, OPT_OVERWRITE },
+        { "tee", no_argument, NULL, OPT_TEE },
+        { "sort", required_argument, NULL, OPT_SORT },
+        { "sysnum", no_argument, NULL, OPT_SYSNUM },
+        { "hist", no_argument, NULL, OPT_HIST },
+        { "hist-sub-bits", required_argument, NULL, OPT_HIST_SUB_BITS },
+        { "format", required_argument, NULL, OPT_FORMAT },
+        { "syscalls", required_argument, NULL, OPT_SYSCALLS },
+        { "run", required_argument, NULL, 'r' },
+        { "pid", required_argument, NULL, 'p' },
+        { "follow", no_argument, NULL, 'f' },
+        { "max-threads", required_argument, NULL, OPT_MAX_THREADS },
+        { "breakdown", required_argument, NULL, OPT_UNSUPPORTED },
+        { "stream", required_argument, NULL, OPT_UNSUPPORTED },
+        { "dynamic", no_argument, NULL, OPT_UNSUPPORTED },
+        { "control", required_argument, NULL, OPT_UNSUPPORTED },
+        { "max-targets", required_argument, NULL, OPT_UNSUPPORTED },
+        { "comm", required_argument, NULL, OPT_UNSUPPORTED },
+        { "cgroup", required_argument, NULL, OPT_UNSUPPORTED },
+        { "repeat", required_argument, NULL, OPT_UNSUPPORTED },
+        { "warmup", required_argument, NULL, OPT_UNSUPPORTED },
+        { "pin-cpu", required_argument, NULL, OPT_UNSUPPORTED },
+        { "randomize-env", no_argument, NULL, OPT_UNSUPPORTED },
+        { "self-stats", no_argument, NULL, OPT_UNSUPPORTED },
+        { "sample", required_argument, NULL, OPT_UNSUPPORTED },
+        { "max-overhead", required_argument, NULL, OPT_UNSUPPORTED },
+        { "serve", required_argument, NULL, OPT_UNSUPPORTED },
+        { "metrics-ttl", required_argument, NULL, OPT_UNSUPPORTED },
+        { "per-cpu", no_argument, NULL, OPT_UNSUPPORTED },
+        { "per-node", no_argument, NULL, OPT_UNSUPPORTED },
+        { "cpus", required_argument, NULL, OPT_UNSUPPORTED },
+        { "clock", required_argument, NULL, OPT_UNSUPPORTED },
+        { "offcpu", no_argument, NULL, OPT_UNSUPPORTED },
+        { "runq", no_argument, NULL, OPT_UNSUPPORTED },
+        { "faults", no_argument, NULL, OPT_UNSUPPORTED },
+        { "errors", no_argument, NULL, OPT_UNSUPPORTED },
+        { "io", optional_argument, NULL, OPT_UNSUPPORTED },
+        { "io-uring", no_argument, NULL, OPT_UNSUPPORTED },
+        { "io-uring-size", required_argument, NULL, OPT_UNSUPPORTED },
+        { "stream-sample", required_argument, NULL, OPT_UNSUPPORTED },
+        { "stream-min-duration", required_argument, NULL, OPT_UNSUPPORTED },
+        { "stream-pages", required_argument, NULL, OPT_UNSUPPORTED },
+        { "trigger-latency", required_argument, NULL, OPT_UNSUPPORTED },
+        { "trigger-rate", required_argument, NULL, OPT_UNSUPPORTED },
+        { "trigger-dir", required_argument, NULL, OPT_UNSUPPORTED },
+        { "trigger-before", required_argument, NULL, OPT_UNSUPPORTED },
+        { "trigger-after", required_argument, NULL, OPT_UNSUPPORTED },
+        { "trigger-events", required_argument, NULL, OPT_UNSUPPORTED },
+        { "trigger-holdoff", required_argument, NULL, OPT_UNSUPPORTED },
+        { "stacks", required_argument, NULL, OPT_UNSUPPORTED },
+        { "stacks-threshold", required_argument, NULL, OPT_UNSUPPORTED },
+        { "kernel-stacks", no_argument, NULL, OPT_UNSUPPORTED },
+        { "stacks-size", required_argument, NULL, OPT_UNSUPPORTED },
+        { "futex", no_argument, NULL, OPT_UNSUPPORTED },
+        { "futex-top", required_argument, NULL, OPT_UNSUPPORTED },
+        { "futex-size", required_argument, NULL, OPT_UNSUPPORTED },
+        { "futex-stacks", no_argument, NULL, OPT_UNSUPPORTED },
+        { "ngrams", required_argument, NULL, OPT_UNSUPPORTED },
+        { "ngrams-top", required_argument, NULL, OPT_UNSUPPORTED },
+        { "ngrams-size", required_argument, NULL, OPT_UNSUPPORTED },
+        { "top", required_argument, NULL, OPT_UNSUPPORTED },
+        { "breakdown-size", required_argument, NULL, OPT_UNSUPPORTED },
+        { NULL, 0, NULL, 0 },
+    };
+    int c, index;
+
+    /* '+' stops at the first non-option, so -r can take the program's arguments */
+    while ((c = getopt_long(argc, argv, "+hd:c:io:r:p:f", long_options, &index)) != -1) {
+        switch (c) {
+        case 'h':
+            usage(stdout);
+            exit(0);
+        case 'd':
+            opts.duration = parse_times(argc, argv, optarg);
+            break;
+        case 'c':
+            opts.checkpoint = parse_times(argc, argv, optarg);
+            break;
+        case 'i':
+            opts.interval = true;
+            break;
+        case 'o':
+            opts.outfile = optarg;
+            break;
+        case OPT_OVERWRITE:
+            opts.overwrite = true;
+            break;
+        case OPT_TEE:
+            opts.tee = true;
+            break;
+        case OPT_SORT:
+            opts.sort = NULL;
+            for (int i = 0; sort_choices[i]; i++) {
+                if (!strcmp(optarg, sort_choices[i])) {
+                    opts.sort = sort_choices[i];
+                }
+            }
+            if (!opts.sort) {
+                parse_error("invalid choice for --sort: '%s'", optarg);
+            }
+            break;
+        case OPT_SYSNUM:
+            opts.sysnum = true;
+            break;
+        case OPT_HIST:
+            opts.hist = true;
+            break;
+        case OPT_HIST_SUB_BITS:
+            opts.hist_sub_bits = strtoul(optarg, NULL, 10);
+            if (opts.hist_sub_bits > HIST_MAX_SUB_BITS) {
+                parse_error("invalid choice for --hist-sub-bits: '%s'", optarg);
+            }
+            break;
+        case OPT_FORMAT:
+            if (!strcmp(optarg, "timeseries")) {
+                opts.timeseries = true;
+            } else if (strcmp(optarg, "text")) {
+                parse_error("invalid choice for --format: '%s'", optarg);
+            }
+            break;
+        case OPT_SYSCALLS:
+            parse_syscalls(optarg);
+            break;
+        case 'r':
+            /* Everything from here on belongs to the traced program,
+             * starting with optarg even in the -rprog and --run=prog forms */
+            argv[optind - 1] = optarg;
+            opts.run = &argv[optind - 1];
+            optind = argc;
+            break;
+        case 'p': {
+            char *end;
+            long pid = strtol(optarg, &end, 10);
+            if (*end == ',') {
+                parse_error("%s", "Multiple pids need the BCC collector.");
+            }
+            if (end == optarg || *end || pid <= 0 || pid > INT_MAX) {
+                parse_error("invalid pid: '%s'", optarg);
+            }
+            opts.pid = pid;
+            break;
+        }
+        case 'f':
+            opts.follow = true;
+            break;
+        case OPT_MAX_THREADS:
+            opts.max_threads = strtoul(optarg, NULL, 10);
+            if (!opts.max_threads) {
+                parse_error("%s", "--max-threads must be positive.");
+            }
+            break;
+        case OPT_UNSUPPORTED:
+            parse_error("--%s needs the BCC collector.", long_options[index].name);
+        default:
+            usage(stderr);
+            exit(2);
+        }
+    }
+
+    if (!opts.sort) {
+        opts.sort = "avg_overhead";
+    }
+    if (opts.run && opts.pid) {
+        parse_error("%s", "argument -p/--pid: not allowed with argument -r/--run");
+    }
+    if (opts.follow && !(opts.run || opts.pid)) {
+        parse_error("%s", "Setting follow mode only makes sense when running with --pid or --run.");
+    }
+    if (sort_needs_hist(opts.sort) && !opts.hist) {
+        parse_error("Sorting by %s requires --hist.", opts.sort);
+    }
+    if (opts.overwrite && !opts.outfile) {
+        parse_error("%s", "--overwrite does not make sense without --outfile.");
+    }
+    if (opts.timeseries && !opts.outfile) {
+        parse_error("%s", "--format timeseries requires --outfile.");
+    }
+    if (opts.tee && !opts.outfile) {
+        parse_error("%s", "--tee does not make sense without --outfile.");
+    }
+    if (!opts.overwrite && opts.outfile && !access(opts.outfile, F_OK)) {
+        parse_error("Cannot overwrite %s without --overwrite.", opts.outfile);
+    }
+    if (geteuid() != 0) {
+        parse_error("%s", "This script must be run with root privileges.");
+    }
+    if (!getenv("SUDO_UID")) {
+        fprintf(stderr, "Warning: You should probably run this script with sudo, not via a root shell.\n");
+    }
+}
+
+/* main below this line ----------------------------------------------------- */
+
+static void handle_exit(int sig)
+{
+    should_exit = 1;
+}
+
+/* Fork <argv> as the sudoer, stopped until we write to the returned pipe */
+static pid_t run_binary(char **argv, int *go_fd)
+{
+    int fds[2];
+    uid_t uid;
+    gid_t gid;
+    pid_t pid;
+    char c;
+
+    if (pipe(fds)) {
+        return -1;
+    }
+    pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[1]);
+        if (!sudo_ids(&uid, &gid)) {
+            setgroups(0, NULL);
+            if (setgid(gid) || setuid(uid)) {
+                _exit(-1);
+            }
+        }
+        /* Wait until the probes are attached */
+        if (read(fds[0], &c, 1) != 1) {
+            _exit(-1);
+        }
+        execvp(argv[0], argv);
+        fprintf(stderr, "Unable to find %s... Exiting...\n", argv[0]);
+        _exit(-1);
+    }
+    close(fds[0]);
+    *go_fd = fds[1];
+    return pid;
+}
+
+static int load_bpf(pid_t trace_pid)
+{
+    int err;
+
+    skel = bpfbench_bpf__open();
+    if (!skel) {
+        fprintf(stderr, "Unable to open BPF skeleton\n");
+        return -1;
+    }
+
+    skel->rodata->bpfbench_pid = getpid();
+    skel->rodata->trace_pid = trace_pid;
+    skel->rodata->follow = opts.follow;
+#ifdef __NR_restart_syscall
+    skel->rodata->restart_syscall_nr = __NR_restart_syscall;
+#endif
+    skel->rodata->histogram = opts.hist;
+    skel->rodata->hist_sub_bits = opts.hist_sub_bits;
+    skel->rodata->filter_syscalls = opts.filter_syscalls;
+    memcpy((void *)skel->rodata->syscall_allowed, opts.syscall_allowed,
+           sizeof(opts.syscall_allowed));
+
+    bpf_map__set_max_entries(skel->maps.intermediate, opts.max_threads);
+    bpf_map__set_max_entries(skel->maps.syscalls, NUM_SYSCALLS);
+    if (opts.hist) {
+        bpf_map__set_max_entries(skel->maps.hists, NUM_SYSCALLS * nbuckets);
+    }
+    if (!opts.follow) {
+        bpf_program__set_autoload(skel->progs.sched_process_fork, false);
+    }
+
+    if ((err = bpfbench_bpf__load(skel))) {
+        fprintf(stderr, "Unable to load BPF program: %s\n", strerror(-err));
+        return -1;
+    }
+    if ((err = bpfbench_bpf__attach(skel))) {
+        fprintf(stderr, "Unable to attach BPF program: %s\n", strerror(-err));
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    char duration[64] = "Forever", checkpoint[64], buf[64];
+    struct timeval last_checkpoint, now;
+    pid_t trace_pid = 0;
+    int go_fd = -1;
+    int err = 0;
+
+    parse_args(argc, argv);
+
+    ncpus = libbpf_num_possible_cpus();
+    nbuckets = opts.hist ? HIST_SLOTS << opts.hist_sub_bits : 0;
+    results = calloc(NUM_SYSCALLS, sizeof(*results));
+    prev_results = calloc(NUM_SYSCALLS, sizeof(*prev_results));
+    percpu_buf = calloc(ncpus, sizeof(struct data_t));
+    if (ncpus <= 0 || !results || !prev_results || !percpu_buf) {
+        fprintf(stderr, "Unable to allocate result buffers\n");
+        return -1;
+    }
+    for (__u32 i = 0; nbuckets && i < NUM_SYSCALLS; i++) {
+        results[i].hist = calloc(nbuckets, sizeof(__u64));
+        prev_results[i].hist = calloc(nbuckets, sizeof(__u64));
+        if (!results[i].hist || !prev_results[i].hist) {
+            fprintf(stderr, "Unable to allocate result buffers\n");
+            return -1;
+        }
+    }
+
+    signal(SIGINT, handle_exit);
+    signal(SIGTERM, handle_exit);
+    signal(SIGCHLD, handle_exit);
+
+    gettimeofday(&start_time, NULL);
+    last_checkpoint = start_time;
+    clock_gettime(CLOCK_MONOTONIC, &last_interval);
+
+    if (opts.duration) {
+        format_timedelta(opts.duration * 1000000LL, duration, sizeof(duration));
+    }
+    format_timedelta(opts.checkpoint * 1000000LL, checkpoint, sizeof(checkpoint));
+    format_datetime(&start_time, buf, sizeof(buf));
+    fprintf(stderr, "Duration:   %s\n", duration);
+    fprintf(stderr, "Checkpoint: %s\n", checkpoint);
+    fprintf(stderr, "Start time: %s\n", buf);
+
+    /* Maybe run a program */
+    if (opts.run) {
+        fprintf(stderr, "Tracing \"");
+        for (char **arg = opts.run; *arg; arg++) {
+            fprintf(stderr, "%s%s", arg == opts.run ? "" : " ", *arg);
+        }
+        fprintf(stderr, "\" for %s...\n", duration);
+        trace_pid = run_binary(opts.run, &go_fd);
+        if (trace_pid < 0) {
+            fprintf(stderr, "Unable to run %s\n", opts.run[0]);
+            return -1;
+        }
+    /* Maybe trace a pid */
+    } else if (opts.pid) {
+        fprintf(stderr, "Tracing pid %d for %s...\n", opts.pid, duration);
+        trace_pid = opts.pid;
+    } else {
+        fprintf(stderr, "Tracing system for %s...\n", duration);
+    }
+
+    if (load_bpf(trace_pid)) {
+        err = -1;
+        goto cleanup;
+    }
+    if (opts.timeseries && open_timeseries()) {
+        err = -1;
+        goto cleanup;
+    }
+
+    if (go_fd >= 0) {
+        if (write(go_fd, "", 1) != 1) {
+            fprintf(stderr, "Unable to start %s\n", opts.run[0]);
+        }
+        close(go_fd);
+    }
+
+    while (!should_exit) {
+        sleep(1);
+        gettimeofday(&now, NULL);
+        if (elapsed_usec(&last_checkpoint, &now) >= opts.checkpoint * 1000000LL) {
+            last_checkpoint = now;
+            save_results();
+        }
+        if (opts.duration && elapsed_usec(&start_time, &now) >= opts.duration * 1000000LL) {
+            should_exit = 1;
+        }
+        /* Traced program exited */
+        if (trace_pid && opts.run && waitpid(trace_pid, NULL, WNOHANG) == trace_pid) {
+            should_exit = 1;
+        }
+    }
+
+    fprintf(stderr, "\n");
+    save_results();
+    fprintf(stderr, "All done!\n");
+
+cleanup:
+    if (timeseries) {
+        fclose(timeseries);
+    }
+    bpfbench_bpf__destroy(skel);
+    return err;
+}
@@ -0,0 +1,52 @@
+/* bpfbench  A better benchmarking tool written in eBPF.
+ * Copyright (C) 2020  William Findlay
+ *
+ * Heavily inspired by syscount from bcc-tools:
+ * https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+/* Definitions shared by the native collector and its CO-RE BPF program.
+ * Layouts match src/bpf/bpf_program.c so results and outfiles are identical. */
+
+#ifndef BPFBENCH_H
+#define BPFBENCH_H
+
+/* Upper bound on system call numbers across supported architectures */
+#define MAX_SYSCALLS 1024
+
+/* Log2 latency slots per histogram, keep in sync with src/defs.py */
+#define HIST_SLOTS 40
+#define HIST_MAX_SUB_BITS 3
+
+/* Indices into the stats map, keep in sync with src/defs.py */
+#define STAT_UNMATCHED_ENTER 0 /* sys_enter while a call was still in flight */
+#define STAT_UNMATCHED_EXIT  1 /* sys_exit without a matching sys_enter */
+#define STAT_TRACKING_FULL   2 /* intermediate map was full at sys_enter */
+#define STAT_STREAM_DROPPED  3 /* unused by the native collector */
+#define STAT_STACKS_LOST     4 /* unused by the native collector */
+#define NUM_STATS            5
+
+struct intermediate_t {
+    __u64 start_time;
+    __u64 sysnum;
+};
+
+struct data_t {
+    __u64 count;
+    __u64 overhead;
+    __u64 max;
+};
+
+#endif /* BPFBENCH_H */
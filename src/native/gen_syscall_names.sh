@@ -0,0 +1,21 @@
+#!/bin/sh
+# Generate the system call name table for the architecture targeted by $CC.
+# Usage: gen_syscall_names.sh [cc] > syscall_names.h
+
+CC=${1:-cc}
+
+echo '/* Generated by gen_syscall_names.sh, do not edit. */'
+echo '#include <asm/unistd.h>'
+echo
+echo 'static const char *syscall_names[] = {'
+echo '#include <asm/unistd.h>' | $CC -E -dM - | awk '
+    $1 == "#define" && $2 ~ /^__NR_/ {
+        name = substr($2, 6)
+        # Not system calls
+        if (name == "syscalls" || name == "arch_specific_syscall")
+            next
+        print name
+    }' | sort -u | while read -r name; do
+    printf '#ifdef __NR_%s\n    [__NR_%s] = "%s",\n#endif\n' "$name" "$name" "$name"
+done
+echo '};'
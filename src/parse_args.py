@@ -22,7 +22,8 @@ import argparse
 import datetime
 import re
 
-from src.utils import drop_privileges
+from src import defs
+from src.utils import drop_privileges, syscall_number, parse_cpu_list, online_cpus
 
 DESCRIPTION = """
 bpfbench
@@ -34,7 +35,16 @@ EPILOG = """
     Copyright (C) 2020  William Findlay
 """
 
-SORT_CHOICES=['sysname', 'sysnum', 'count', 'overhead', 'avg_overhead']
+FORMAT_CHOICES=['text', 'timeseries', 'export']
+
+CLOCK_CHOICES=['mono', 'boot', 'coarse', 'tai']
+
+SORT_CHOICES=['sysname', 'sysnum', 'count', 'overhead', 'avg_overhead',
+        'p50', 'p90', 'p99', 'p99.9', 'max', 'errors', 'err_overhead']
+HIST_SORT_CHOICES=['p50', 'p90', 'p99', 'p99.9', 'max']
+ERROR_SORT_CHOICES=['errors', 'err_overhead']
+
+IO_DEFAULT=['read', 'write', 'pwrite64', 'sendmsg', 'sendto', 'fdatasync']
 
 class ParserTimeDeltaType():
     """
@@ -111,6 +121,76 @@ class ParserNewFileType():
         # Join f with new d
         return os.path.join(d, f)
 
+class ParserSyscallListType():
+    """
+    Arguments of type comma-separated system call list.
+    Converts names (or numbers) into system call numbers.
+    """
+    def __call__(self, value):
+        sysnums = []
+        for name in value.split(','):
+            name = name.strip()
+            if not name:
+                continue
+            num = int(name) if name.isdigit() else syscall_number(name)
+            if num is None:
+                raise argparse.ArgumentTypeError(f'Unknown system call "{name}".')
+            sysnums.append(num)
+        if not sysnums:
+            raise argparse.ArgumentTypeError(f'Empty system call list.')
+        return sysnums
+
+class ParserPidListType():
+    """
+    Arguments of type comma-separated pid list.
+    """
+    def __call__(self, value):
+        try:
+            pids = [int(pid) for pid in value.split(',') if pid.strip()]
+        except ValueError:
+            raise argparse.ArgumentTypeError(f'Invalid pid list "{value}".')
+        if not pids or any(pid <= 0 for pid in pids):
+            raise argparse.ArgumentTypeError(f'Invalid pid list "{value}".')
+        return pids
+
+class ParserCommListType():
+    """
+    Arguments of type comma-separated command name list.
+    Names are truncated to TASK_COMM_LEN - 1 like the kernel does.
+    """
+    def __call__(self, value):
+        comms = [comm.strip()[:15] for comm in value.split(',') if comm.strip()]
+        if not comms:
+            raise argparse.ArgumentTypeError(f'Empty command name list.')
+        return comms
+
+class ParserCpuListType():
+    """
+    Arguments of type cpulist, like: 0-3,8.
+    """
+    def __call__(self, value):
+        try:
+            cpus = parse_cpu_list(value)
+        except ValueError:
+            raise argparse.ArgumentTypeError(f'Invalid CPU list "{value}".')
+        if not cpus:
+            raise argparse.ArgumentTypeError(f'Empty CPU list.')
+        return cpus
+
+class ParserAddressType():
+    """
+    Arguments of type [host:]port. The host defaults to localhost.
+    """
+    def __call__(self, value):
+        host, _, port = value.rpartition(':')
+        try:
+            port = int(port)
+        except ValueError:
+            raise argparse.ArgumentTypeError(f'Invalid port in "{value}".')
+        if not 0 < port < 65536:
+            raise argparse.ArgumentTypeError(f'Invalid port in "{value}".')
+        return host.strip('[]') or '127.0.0.1', port
+
 def parse_args(sysargs=sys.argv[1:]):
     """
     Argument parsing logic.
@@ -127,6 +207,9 @@ def parse_args(sysargs=sys.argv[1:]):
             help='Interval to checkpoint results. Defaults to 30m.\n'
             'Supports values like: #[s] #m #h #d #w.\n'
             'Durations can be combined like: 1m 30s.')
+    timings.add_argument('-i', '--interval', action='store_true',
+            help='Report counts and rates (calls/s, us/s) for each checkpoint interval\n'
+            'instead of cumulative totals.')
 
     output = parser.add_argument_group('output options')
     output.add_argument('-o', '--outfile', type=ParserNewFileType(),
@@ -141,38 +224,345 @@ def parse_args(sysargs=sys.argv[1:]):
     #        help='Do not print average overhead.')
     output.add_argument('--sysnum', action='store_true',
             help='Print system call number.')
+    output.add_argument('--offcpu', action='store_true',
+            help='Split system call latency into time on the CPU and time switched out\n'
+            '(blocked or preempted), by also tracing sched_switch.')
+    output.add_argument('--runq', action='store_true',
+            help='Time how long threads inside a system call wait on the run queue\n'
+            'after a wakeup or preemption, by also tracing sched_wakeup and sched_switch.\n'
+            'Prints a latency histogram and quantiles per system call.')
+    output.add_argument('--faults', action='store_true',
+            help='Also time page faults taken in user mode, by probing handle_mm_fault,\n'
+            'and print minor and major faults as extra rows of the table.')
+    output.add_argument('--errors', action='store_true',
+            help='Count failed calls per errno and report count and latency\n'
+            'of successful and failed calls separately.')
+    output.add_argument('--format', type=str, choices=FORMAT_CHOICES, default='text',
+            help='Format of outfile. "text" rewrites the table at every checkpoint,\n'
+            '"timeseries" appends fixed-width binary rows for every checkpoint\n'
+            '(see bpfbench convert), "export" rewrites a compact binary file\n'
+            'with host metadata that bpfbench merge combines. Defaults to text.')
+    output.add_argument('--hist', action='store_true',
+            help='Keep per-CPU log2 latency histograms in the kernel\n'
+            'and print p50, p90, p99, p99.9 and max latency.')
+    output.add_argument('--hist-sub-bits', metavar='N', type=int, choices=range(4), default=0,
+            help='Split each log2 bucket into 2^N linear sub-buckets (0-3).\n'
+            'Map size grows by the same factor. Defaults to 0.')
+
+    daemon = parser.add_argument_group('daemon options')
+    daemon.add_argument('--serve', metavar='[host:]port', type=ParserAddressType(),
+            help='Serve results on http://host:port/metrics in Prometheus text format\n'
+            'instead of checkpointing them. Use 0.0.0.0:port to listen on all addresses.')
+    daemon.add_argument('--metrics-ttl', metavar='seconds', type=float, default=1.0,
+            help='Reuse the previous scrape for this long before reading the maps again.\n'
+            'Defaults to 1.')
+
+    cpus = parser.add_argument_group('CPU options')
+    cpus.add_argument('--per-cpu', action='store_true',
+            help='Also print count and latency per CPU, grouped by NUMA node,\n'
+            'with how unevenly system call time is spread across CPUs.')
+    cpus.add_argument('--per-node', action='store_true',
+            help='Also print count and latency per NUMA node.')
+    cpus.add_argument('--cpus', metavar='list', type=ParserCpuListType(),
+            help='Only report calls made on these CPUs, like: 0-3,8.\n'
+            'Everything is still counted in the kernel, so this costs nothing.')
+
+    filters = parser.add_argument_group('filtering options')
+    filters.add_argument('--syscalls', metavar='list', type=ParserSyscallListType(),
+            help='Only trace these system calls, like: read,write,futex.\n'
+            'Other system calls return from the probe before reading the clock.')
+
+    io = parser.add_argument_group('I/O options')
+    io.add_argument('--io', metavar='list', type=ParserSyscallListType(), nargs='?', const=IO_DEFAULT,
+            help='Also count bytes and classify the fd (file, socket, pipe) of these\n'
+            'system calls, whose first argument must be a file descriptor.\n'
+            'Prints bytes/s and us/KB. Defaults to read,write,pwrite64,sendmsg,sendto,fdatasync.')
+
+    io.add_argument('--io-uring', action='store_true',
+            help='Also time io_uring requests from submission to completion per opcode,\n'
+            'and print them as [async:<op>] rows of the table. Before Linux 5.15,\n'
+            'in-flight requests of a ring are told apart by their user_data only.')
+    io.add_argument('--io-uring-size', metavar='N', type=int, default=16384,
+            help='Maximum number of in-flight requests kept in the kernel.\n'
+            'Least recently used ones are evicted. Defaults to 16384.')
+
+    streaming = parser.add_argument_group('streaming options')
+    streaming.add_argument('--stream', metavar='file', type=ParserNewFileType(),
+            help='Stream per-event records (tid, syscall, start, duration, return value)\n'
+            'through a BPF ring buffer into binary file <file>.')
+    streaming.add_argument('--stream-sample', metavar='N', type=int, default=1,
+            help='Only stream one in N eligible events. Defaults to 1.')
+    streaming.add_argument('--stream-min-duration', metavar='us', type=float, default=0,
+            help='Only stream events that took at least <us> microseconds.')
+    streaming.add_argument('--stream-pages', metavar='N', type=int, default=256,
+            help='Size of the ring buffer in pages, a power of two. Defaults to 256.')
+
+    triggers = parser.add_argument_group('trigger options')
+    triggers.add_argument('--trigger-latency', metavar='us', type=float,
+            help='Capture a snapshot whenever a system call takes at least <us> microseconds.')
+    triggers.add_argument('--trigger-rate', metavar='N', type=int,
+            help='Capture a snapshot whenever one system call is made N times within a second.')
+    triggers.add_argument('--trigger-dir', metavar='dir', type=str,
+            help='Write each snapshot to <dir>/trigger-<n>.txt. Required with --trigger-*.')
+    triggers.add_argument('--trigger-before', metavar='ms', type=float, default=100,
+            help='Keep the calls that ended up to <ms> milliseconds before the trigger.\n'
+            'Defaults to 100.')
+    triggers.add_argument('--trigger-after', metavar='ms', type=float, default=100,
+            help='Wait <ms> milliseconds after the trigger before capturing. Defaults to 100.')
+    triggers.add_argument('--trigger-events', metavar='N', type=int, default=4096,
+            help='Recent calls kept per CPU for the snapshot, bounding how far back\n'
+            '--trigger-before can reach on a busy CPU. Defaults to 4096.')
+    triggers.add_argument('--trigger-holdoff', metavar='s', type=float, default=10,
+            help='Minimum time between two triggers in seconds. Defaults to 10.')
+
+    stacks = parser.add_argument_group('stack options')
+    stacks.add_argument('--stacks', metavar='file', type=ParserNewFileType(),
+            help='Record the user stack of every system call slower than --stacks-threshold\n'
+            'and write total time per (process, stack, system call) to <file>\n'
+            'as folded stacks, e.g. for flamegraph.pl --countname=us.')
+    stacks.add_argument('--stacks-threshold', metavar='us', type=float, default=1000,
+            help='Only record stacks of calls that took at least <us> microseconds.\n'
+            'Defaults to 1000.')
+    stacks.add_argument('--kernel-stacks', action='store_true',
+            help='Also record the kernel stack where each call first blocked,\n'
+            'by tracing sched_switch.')
+    stacks.add_argument('--stacks-size', metavar='N', type=int, default=16384,
+            help='Maximum number of distinct stacks kept in the kernel. Defaults to 16384.')
+
+    futex = parser.add_argument_group('futex options')
+    futex.add_argument('--futex', action='store_true',
+            help='Also aggregate futex wait time per (process, lock word address)\n'
+            'and print the most contended locks.')
+    futex.add_argument('--futex-top', metavar='N', type=int, default=10,
+            help='Number of lock words to print. Defaults to 10.')
+    futex.add_argument('--futex-size', metavar='N', type=int, default=16384,
+            help='Maximum number of lock words kept in the kernel.\n'
+            'Least recently used ones are evicted. Defaults to 16384.')
+    futex.add_argument('--futex-stacks', action='store_true',
+            help='Also record the user stack of the slowest wait on each lock word.\n'
+            'Shares --stacks-size with --stacks.')
+
+    sequences = parser.add_argument_group('sequence options')
+    sequences.add_argument('--ngrams', metavar='N', type=int, choices=[2, 3],
+            help='Also count sequences of N consecutive system calls of a thread (2 or 3)\n'
+            'with their summed latency, and print the hottest ones.')
+    sequences.add_argument('--ngrams-top', metavar='N', type=int, default=20,
+            help='Number of sequences to print. Defaults to 20.')
+    sequences.add_argument('--ngrams-size', metavar='N', type=int, default=16384,
+            help='Maximum number of sequences kept in the kernel.\n'
+            'Least recently used ones are evicted. Defaults to 16384.')
+
+    breakdown = parser.add_argument_group('breakdown options')
+    breakdown.add_argument('--breakdown', type=str, choices=['pid', 'cgroup'],
+            help='Also aggregate results per process or per cgroup\n'
+            'and print the top consumers.')
+    breakdown.add_argument('--top', metavar='N', type=int, default=10,
+            help='Number of top consumers to print. Defaults to 10.')
+    breakdown.add_argument('--breakdown-size', metavar='N', type=int, default=16384,
+            help='Maximum number of (consumer, system call) pairs kept in the kernel.\n'
+            'Least recently used pairs are evicted. Defaults to 16384.')
 
     _micro = parser.add_argument_group('micro-benchmark options')
-    micro = _micro.add_mutually_exclusive_group()
-    micro.add_argument('-r', '--run', metavar='prog', type=str,
+    _micro.add_argument('-r', '--run', metavar='prog', type=str,
             help='Run program <prog> instead of benchmarking entire system.')
-    micro.add_argument('-p', '--pid', metavar='pid', type=int,
-            help='Attach to program with userspace pid <pid> instead of benchmarking entire system.')
+    _micro.add_argument('-p', '--pid', metavar='pid', type=ParserPidListType(),
+            help='Attach to programs with userspace pids <pid>[,<pid>...] instead of benchmarking entire system.')
+    _micro.add_argument('--comm', metavar='name', type=ParserCommListType(),
+            help='Trace processes whose command name is <name>[,<name>...].')
+    _micro.add_argument('--cgroup', metavar='path', type=str, action='append',
+            help='Trace processes inside cgroup v2 directory <path>. May be repeated.')
     _micro.add_argument('-f', '--follow', action='store_true',
-            help='Follow child processes. Only makes sense when used with -p or -r.')
+            help='Follow child processes. Only makes sense when used with -p, -r, --comm or --cgroup.')
+    _micro.add_argument('--dynamic', action='store_true',
+            help='Keep traced pids in a BPF map instead of compiling them in,\n'
+            'so they can change without reloading. Costs a hash lookup per event.')
+    _micro.add_argument('--control', metavar='fifo', type=ParserNewFileType(),
+            help='Create named pipe <fifo> that accepts commands while running:\n'
+            '"add <pid>", "remove <pid>", "follow on|off", "all".\n'
+            'Implies --dynamic.')
+    _micro.add_argument('--repeat', metavar='N', type=int,
+            help='Run the -r program N times under one loaded BPF program and report\n'
+            'per-iteration results with their median and MAD.')
+    _micro.add_argument('--warmup', metavar='K', type=int, default=0,
+            help='With --repeat, run the program K more times first and ignore them.')
+    _micro.add_argument('--pin-cpu', metavar='cpu', type=int,
+            help='Pin the -r program to CPU <cpu>.')
+    _micro.add_argument('--randomize-env', action='store_true',
+            help='Pad the environment of each -r run by a random length, so that\n'
+            'stack alignment effects average out over --repeat runs.')
+    _micro.add_argument('--max-targets', metavar='N', type=int, default=10240,
+            help='Maximum number of traced pids with --dynamic. Defaults to 10240.')
+
+    advanced = parser.add_argument_group('advanced options')
+    advanced.add_argument('--sample', metavar='N', type=int,
+            help='Only time one in N traced system calls on each CPU and scale counts,\n'
+            'overhead and histograms back up. Reports confidence intervals.')
+    advanced.add_argument('--max-overhead', metavar='pct', type=float,
+            help='Adjust the sampling rate every second to keep probe run time under\n'
+            '<pct> percent of total CPU time. Implies --sample and --self-stats.')
+    advanced.add_argument('--self-stats', action='store_true',
+            help='Enable kernel BPF run-time statistics and report what the probes\n'
+            'cost per event and in CPU%%, next to the results.')
+    advanced.add_argument('--clock', type=str, choices=CLOCK_CHOICES, default='mono',
+            help='Clock read at every sys_enter and sys_exit. "boot" also counts time\n'
+            'suspended (Linux 5.8), "coarse" is cheaper but only advances every tick,\n'
+            'so short calls read as 0 (Linux 5.11), "tai" needs Linux 6.1.\n'
+            'Defaults to mono, the monotonic clock.')
+    advanced.add_argument('--max-threads', metavar='N', type=int, default=65536,
+            help='Maximum number of threads with a system call in flight at once.\n'
+            'Defaults to 65536.')
 
     parser.add_argument('--debug', action='store_true',
             help=argparse.SUPPRESS)
 
     # Hack to allow arguments to be passed to the analyzed program
     try:
-        index_of_run = sysargs.index('--run')
+        index_of_run = min(sysargs.index(flag) for flag in ['-r', '--run'] if flag in sysargs)
+        args = parser.parse_args(sysargs[:index_of_run + 2])
+        vars(args)['runargs'] = sysargs[index_of_run + 1:]
     except ValueError:
-        try:
-            index_of_run = sysargs.index('-r')
-            args = parser.parse_args(sysargs[:index_of_run + 2])
-            vars(args)['runargs'] = sysargs[index_of_run + 1:]
-        except ValueError:
-            args = parser.parse_args(sysargs)
-            vars(args)['runargs'] = []
+        args = parser.parse_args(sysargs)
+        vars(args)['runargs'] = []
 
     # Check for whether follow makes sense
-    if args.follow and not (args.run or args.pid):
-        parser.error(f"Setting follow mode only makes sense when running with --pid or --run.")
+    if args.follow and not (args.run or args.pid or args.comm or args.cgroup or args.control):
+        parser.error(f"Setting follow mode only makes sense when running with --pid, --run, --comm, --cgroup or --control.")
+
+    # Check whether cgroups exist
+    for path in args.cgroup or []:
+        if not os.path.isdir(path):
+            parser.error(f"cgroup {path} does not exist.")
+
+    # Check whether repeated runs make sense
+    if (args.repeat is not None or args.warmup) and not args.run:
+        parser.error(f"--repeat and --warmup require --run.")
+    if args.repeat is not None and (args.repeat <= 0 or args.warmup < 0):
+        parser.error(f"--repeat must be positive and --warmup non-negative.")
+    if args.warmup and args.repeat is None:
+        parser.error(f"--warmup requires --repeat.")
+    if args.repeat and (args.pid or args.comm or args.cgroup or args.interval):
+        parser.error(f"--repeat only traces the -r program and cannot be combined with\n"
+                "--pid, --comm, --cgroup or --interval.")
+    if args.pin_cpu is not None and not (args.run and 0 <= args.pin_cpu < os.cpu_count()):
+        parser.error(f"--pin-cpu requires --run and an online CPU.")
+    if args.randomize_env and not args.run:
+        parser.error(f"--randomize-env requires --run.")
+
+    # Only a single pid can be compiled into the BPF program, and each repeated run is a new one
+    num_pids = len(args.pid or []) + (1 if args.run else 0)
+    if num_pids > 1 or args.comm or args.cgroup or args.repeat:
+        args.dynamic = True
+
+    # Check whether dynamic filtering makes sense
+    if args.control:
+        args.dynamic = True
+        if os.path.exists(args.control):
+            parser.error(f"{args.control} already exists.")
+    if args.max_targets <= 0:
+        parser.error(f"--max-targets must be positive.")
+
+    # Check whether sorting by latency quantiles makes sense
+    if args.sort in HIST_SORT_CHOICES and not args.hist:
+        parser.error(f"Sorting by {args.sort} requires --hist.")
+    if args.sort in ERROR_SORT_CHOICES and not args.errors:
+        parser.error(f"Sorting by {args.sort} requires --errors.")
+
+    # Check whether breakdown options make sense
+    if args.top <= 0 or args.breakdown_size <= 0:
+        parser.error(f"--top and --breakdown-size must be positive.")
+
+    # Check whether streaming options make sense
+    if args.stream_sample <= 0 or args.stream_min_duration < 0:
+        parser.error(f"--stream-sample must be positive and --stream-min-duration non-negative.")
+    if args.stream_pages <= 0 or args.stream_pages & (args.stream_pages - 1):
+        parser.error(f"--stream-pages must be a power of two.")
+    if args.stream and os.path.exists(args.stream) and not args.overwrite:
+        parser.error(f"Cannot overwrite {args.stream} without --overwrite.")
+
+    # Check whether trigger options make sense
+    args.trigger = args.trigger_latency is not None or args.trigger_rate is not None
+    if args.trigger and not args.trigger_dir:
+        parser.error(f"--trigger-latency and --trigger-rate require --trigger-dir.")
+    if args.trigger_dir and not args.trigger:
+        parser.error(f"--trigger-dir requires --trigger-latency or --trigger-rate.")
+    if args.trigger_dir and not os.path.isdir(args.trigger_dir):
+        parser.error(f"{args.trigger_dir} is not a directory.")
+    if (args.trigger_latency or 0) < 0 or (args.trigger_rate is not None and args.trigger_rate <= 0):
+        parser.error(f"--trigger-latency must be non-negative and --trigger-rate positive.")
+    if args.trigger_before < 0 or args.trigger_after < 0 or args.trigger_holdoff < 0:
+        parser.error(f"--trigger-before, --trigger-after and --trigger-holdoff must be non-negative.")
+    if args.trigger_events <= 0:
+        parser.error(f"--trigger-events must be positive.")
+
+    # Check whether I/O options make sense
+    if args.io is IO_DEFAULT:
+        args.io = [syscall_number(name) for name in IO_DEFAULT if syscall_number(name) is not None]
+        if args.syscalls:
+            args.io = [num for num in args.io if num in args.syscalls]
+    if args.syscalls and not set(args.io or []) <= set(args.syscalls):
+        parser.error(f"--io system calls must also be in --syscalls.")
+    if args.io == []:
+        parser.error(f"None of the default --io system calls are traced.")
+
+    # Check whether io_uring options make sense
+    if args.io_uring_size <= 0:
+        parser.error(f"--io-uring-size must be positive.")
+
+    # Check whether futex options make sense
+    if args.futex_stacks and not args.futex:
+        parser.error(f"--futex-stacks requires --futex.")
+    if args.futex_top <= 0 or args.futex_size <= 0:
+        parser.error(f"--futex-top and --futex-size must be positive.")
+    if args.futex and args.syscalls and syscall_number('futex') not in args.syscalls:
+        parser.error(f"--futex requires futex in --syscalls.")
+
+    # Check whether sequence options make sense
+    if args.ngrams_top <= 0 or args.ngrams_size <= 0:
+        parser.error(f"--ngrams-top and --ngrams-size must be positive.")
+    if args.ngrams and args.sample:
+        parser.error(f"--ngrams needs every call, it cannot be combined with --sample.")
+
+    # Check whether stack options make sense
+    if args.kernel_stacks and not args.stacks:
+        parser.error(f"--kernel-stacks requires --stacks.")
+    if args.stacks_threshold < 0 or args.stacks_size <= 0:
+        parser.error(f"--stacks-threshold must be non-negative and --stacks-size positive.")
+    if args.stacks and os.path.exists(args.stacks) and not args.overwrite:
+        parser.error(f"Cannot overwrite {args.stacks} without --overwrite.")
+
+    # Check whether CPU options make sense
+    offline = sorted(set(args.cpus or []) - set(online_cpus()))
+    if offline:
+        parser.error(f"--cpus includes offline CPUs {','.join(map(str, offline))}.")
+    if (args.per_cpu or args.per_node) and args.repeat:
+        parser.error(f"--per-cpu and --per-node cannot be combined with --repeat.")
+
+    # Check whether sampling makes sense
+    if args.sample is not None and not 1 <= args.sample <= defs.MAX_SAMPLE_RATE:
+        parser.error(f"--sample must be between 1 and {defs.MAX_SAMPLE_RATE}.")
+    if args.max_overhead is not None:
+        if not 0 < args.max_overhead < 100:
+            parser.error(f"--max-overhead must be between 0 and 100.")
+        args.sample = args.sample or 1
+        args.self_stats = True
+
+    # Check whether daemon options make sense
+    if args.metrics_ttl < 0:
+        parser.error(f"--metrics-ttl must be non-negative.")
+    if args.serve and args.repeat:
+        parser.error(f"--serve cannot be combined with --repeat.")
+
+    # Check whether max_threads makes sense
+    if args.max_threads <= 0:
+        parser.error(f"--max-threads must be positive.")
 
     # Check whether overwrite makes sense
-    if args.overwrite and not args.outfile:
-        parser.error(f"--overwrite does not make sense without --outfile.")
+    if args.overwrite and not (args.outfile or args.stream or args.stacks):
+        parser.error(f"--overwrite does not make sense without --outfile, --stream or --stacks.")
+
+    # Check whether format makes sense
+    if args.format != 'text' and not args.outfile:
+        parser.error(f"--format {args.format} requires --outfile.")
 
     # Check whether tee makes sense
     if args.tee and not args.outfile:
@@ -191,3 +581,69 @@ def parse_args(sysargs=sys.argv[1:]):
         print('Warning: You should probably run this script with sudo, not via a root shell.', file=sys.stderr)
 
     return args
+
+def parse_convert_args(sysargs):
+    """
+    Argument parsing logic for bpfbench convert.
+    """
+    parser = argparse.ArgumentParser(prog='bpfbench convert',
+            description='Print a snapshot of a time-series outfile as a text table.')
+    parser.add_argument('file', type=str,
+            help='Time-series file written with --format timeseries.')
+    parser.add_argument('--at', metavar='N', type=int, default=-1,
+            help='Index of the snapshot to print, negative counts from the end.\n'
+            'Defaults to the last snapshot.')
+    # Time-series rows do not keep errno counts
+    sort_choices = [c for c in SORT_CHOICES if c not in ERROR_SORT_CHOICES]
+    parser.add_argument('--sort', type=str, choices=sort_choices, default='avg_overhead',
+            help=f'Sort by {", ".join(sort_choices)}. Defaults to avg_overhead.')
+    parser.add_argument('--sysnum', action='store_true',
+            help='Print system call number.')
+    return parser.parse_args(sysargs)
+
+def parse_merge_args(sysargs):
+    """
+    Argument parsing logic for bpfbench merge.
+    """
+    parser = argparse.ArgumentParser(prog='bpfbench merge',
+            description='Combine export files of many hosts or runs into one.\n'
+            'Histograms are merged bucket by bucket, so merged percentiles are exact.',
+            formatter_class=argparse.RawTextHelpFormatter)
+    parser.add_argument('files', metavar='file', type=str, nargs='+',
+            help='Files written with --format export, or directories of them.')
+    parser.add_argument('-o', '--outfile', metavar='file', type=str,
+            help='Write the merged export file to <file> instead of printing a table.')
+    # Export rows are keyed by name, numbers differ across architectures
+    sort_choices = [c for c in SORT_CHOICES if c not in ERROR_SORT_CHOICES + ['sysnum']]
+    parser.add_argument('--sort', type=str, choices=sort_choices, default='avg_overhead',
+            help=f'Sort by {", ".join(sort_choices)}. Defaults to avg_overhead.')
+    parser.add_argument('--strict', action='store_true',
+            help='Exit with status -1 if any file could not be read.')
+    return parser.parse_args(sysargs)
+
+def parse_compare_args(sysargs):
+    """
+    Argument parsing logic for bpfbench compare.
+    """
+    parser = argparse.ArgumentParser(prog='bpfbench compare',
+            description='Compare per-syscall results of two runs, A then B.\n'
+            'Significance comes from the histogram buckets of --hist time-series files.',
+            formatter_class=argparse.RawTextHelpFormatter)
+    parser.add_argument('a', type=str,
+            help='Baseline text, time-series or export outfile.')
+    parser.add_argument('b', type=str,
+            help='Text, time-series or export outfile to compare against the baseline.')
+    parser.add_argument('--at', metavar='N', type=int, default=-1,
+            help='Index of the time-series snapshot to compare, negative counts from the end.\n'
+            'Defaults to the last snapshot.')
+    parser.add_argument('--alpha', metavar='p', type=float, default=0.01,
+            help='Mark changes whose p-value is below <p> with "*". Defaults to 0.01.')
+    parser.add_argument('--fail-above', metavar='pct', type=float,
+            help='Exit with status 1 if the mean latency of any system call grew\n'
+            'by more than <pct> percent (and significantly, given histograms).')
+    args = parser.parse_args(sysargs)
+
+    if not 0 < args.alpha < 1:
+        parser.error(f"--alpha must be between 0 and 1.")
+
+    return args
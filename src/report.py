@@ -0,0 +1,302 @@
+# bpfbench  A better benchmarking tool written in eBPF.
+# Copyright (C) 2020  William Findlay
+#
+# Heavily inspired by syscount from bcc-tools:
+# https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import statistics
+
+from src import histogram
+from src.utils import process_name, syscall_name
+
+def sort_key(sort):
+    """
+    Return a sort key for (sysname, result) pairs based on sort argument.
+    """
+    def key(item):
+        if sort == 'sysname':
+            return item[0]
+        try:
+            return item[1][sort]
+        except KeyError:
+            raise TypeError(f"Unable to sort based on {sort}")
+    return key
+
+def top_errno(result):
+    """
+    Return the most common errno of a result and its share of failed calls.
+    Pseudo-rows, such as io_uring completions, count errors without errnos.
+    """
+    if not result['errors'] or not result['errnos']:
+        return '-'
+    name, count = max(result['errnos'].items(), key=lambda e: e[1])
+    return f'{name} ({count / result["errors"]:.0%})'
+
+def format_table(results, sort='avg_overhead', sysnum=False, hist=False, interval=False,
+        offcpu=False, io=False, errors=False, sampling=False):
+    """
+    Render per-syscall results as the bpfbench text table.
+    """
+    lines = []
+    # Add header
+    header = f'{"NUM":<3s} ' if sysnum else ''
+    header += f'{"SYSCALL":<22s} {"COUNT":>8s} {"OVERHEAD(us)":>22s} {"AVG_OVERHEAD(us/call)":>22s}'
+    if hist:
+        for q, _ in histogram.QUANTILES:
+            header += f' {q.upper() + "(us)":>13s}'
+        header += f' {"MAX(us)":>13s}'
+    if offcpu:
+        header += f' {"ONCPU(us)":>22s} {"OFFCPU(us)":>22s}'
+    if interval:
+        header += f' {"CALLS/s":>13s} {"US/s":>13s}'
+    if io:
+        header += f' {"BYTES":>16s} {"BYTES/s":>16s} {"US/KB":>13s}'
+    if sampling:
+        header += f' {"SAMPLES":>10s} {"COUNT_CI(%)":>12s} {"AVG_CI(us)":>12s}'
+    if errors:
+        header += f' {"ERRORS":>10s} {"AVG_OK(us/call)":>16s} {"AVG_ERR(us/call)":>16s}  TOP ERRNO'
+    lines.append(header)
+    # Add results
+    reverse = sort not in ['sysname', 'sysnum']
+    for k, v in sorted(results.items(), key=sort_key(sort), reverse=reverse):
+        # Pseudo-rows, such as page faults, have no system call number
+        if sysnum:
+            line = f'{v["sysnum"]:<3d} ' if v['sysnum'] >= 0 else f'{"-":<3s} '
+        else:
+            line = ''
+        line += f'{k:<22s} {v["count"]:>8d} {v["overhead"] :>22.3f}{v["avg_overhead"] :>22.3f}'
+        if hist:
+            for q, _ in histogram.QUANTILES:
+                line += f' {v[q]:>13.3f}'
+            line += f' {v["max"]:>13.3f}'
+        if offcpu and 'oncpu' in v:
+            line += f' {v["oncpu"]:>22.3f} {v["offcpu"]:>22.3f}'
+        elif offcpu:
+            line += f' {"-":>22s} {"-":>22s}'
+        if interval:
+            line += f' {v["rate"]:>13.3f} {v["utilization"]:>13.3f}'
+        if io and 'bytes' in v:
+            line += f' {v["bytes"]:>16d} {v["throughput"]:>16.1f} {v["us_per_kb"]:>13.3f}'
+        elif io:
+            line += f' {"-":>16s} {"-":>16s} {"-":>13s}'
+        if sampling:
+            line += f' {v["samples"]:>10d} {v["count_ci"] * 100:>12.1f} {v["avg_ci"]:>12.3f}'
+        if errors:
+            line += f' {v["errors"]:>10d} {v["avg_ok"]:>16.3f} {v["avg_err"]:>16.3f}  {top_errno(v)}'
+        lines.append(line)
+    return '\n'.join(lines) + '\n'
+
+def format_io_table(results):
+    """
+    Render the per fd type breakdown of I/O system calls, by overhead.
+    """
+    lines = []
+    lines.append(f'{"SYSCALL":<22s} {"FD":<8s} {"COUNT":>8s} {"BYTES":>16s} {"BYTES/s":>16s} {"AVG_OVERHEAD(us/call)":>22s} {"US/KB":>13s}')
+    rows = [(k, fd_type, e) for k, v in results.items() for fd_type, e in v.get('io', {}).items()]
+    for k, fd_type, e in sorted(rows, key=lambda row: row[2]['overhead'], reverse=True):
+        lines.append(f'{k:<22s} {fd_type:<8s} {e["count"]:>8d} {e["bytes"]:>16d} {e["throughput"]:>16.1f} {e["avg_overhead"]:>22.3f} {e["us_per_kb"]:>13.3f}')
+    return '\n'.join(lines) + '\n'
+
+def imbalance(values):
+    """
+    Return max/mean and the coefficient of variation (%) of <values>.
+    Both are 1 and 0 when the load is spread perfectly evenly.
+    """
+    mean = statistics.mean(values) if values else 0
+    if not mean:
+        return 1.0, 0.0
+    return max(values) / mean, statistics.pstdev(values) / mean * 100
+
+def format_imbalance(what, values):
+    """
+    Render the imbalance of overhead across <what>.
+    """
+    ratio, cv = imbalance(values)
+    return f'Imbalance across {what}: max/mean {ratio:.2f}, CV {cv:.1f}%\n'
+
+def format_cpu_table(cpus):
+    """
+    Render per-CPU totals grouped by NUMA node, with the imbalance of overhead.
+    """
+    total = sum(e['overhead'] for e in cpus.values()) or 1
+    lines = []
+    lines.append(f'{"NODE":>4s} {"CPU":>4s} {"COUNT":>12s} {"OVERHEAD(us)":>22s} {"AVG_OVERHEAD(us/call)":>22s} {"SHARE(%)":>9s}  TOP SYSCALL')
+    for cpu, e in sorted(cpus.items(), key=lambda item: (item[1]['node'], item[0])):
+        avg = e['overhead'] / e['count'] if e['count'] else 0
+        top = max(e['syscalls'].items(), key=lambda s: s[1])[0] if e['syscalls'] else '-'
+        lines.append(f'{e["node"]:>4d} {cpu:>4d} {e["count"]:>12d} {e["overhead"]:>22.3f} {avg:>22.3f} {e["overhead"] / total * 100:>9.2f}  {top}')
+    return '\n'.join(lines) + '\n' + format_imbalance('CPUs', [e['overhead'] for e in cpus.values()])
+
+def format_node_table(cpus):
+    """
+    Render per-node totals of the CPUs in <cpus>, with the imbalance of overhead.
+    """
+    nodes = {}
+    for cpu, e in cpus.items():
+        node = nodes.setdefault(e['node'], {'cpus': 0, 'count': 0, 'overhead': 0.0})
+        node['cpus'] += 1
+        node['count'] += e['count']
+        node['overhead'] += e['overhead']
+    total = sum(e['overhead'] for e in nodes.values()) or 1
+    lines = []
+    lines.append(f'{"NODE":>4s} {"CPUS":>4s} {"COUNT":>12s} {"OVERHEAD(us)":>22s} {"AVG_OVERHEAD(us/call)":>22s} {"SHARE(%)":>9s} {"US/CPU":>16s}')
+    for node, e in sorted(nodes.items()):
+        avg = e['overhead'] / e['count'] if e['count'] else 0
+        lines.append(f'{node:>4d} {e["cpus"]:>4d} {e["count"]:>12d} {e["overhead"]:>22.3f} {avg:>22.3f} {e["overhead"] / total * 100:>9.2f} {e["overhead"] / e["cpus"]:>16.3f}')
+    # Nodes may have different numbers of CPUs, so compare per-CPU load
+    return '\n'.join(lines) + '\n' + format_imbalance('nodes', [e['overhead'] / e['cpus'] for e in nodes.values()])
+
+def format_runq_table(results):
+    """
+    Render run queue waits per system call, by total wait.
+    SHARE is the part of the system call's latency spent waiting for a CPU.
+    """
+    lines = []
+    lines.append(f'{"SYSCALL":<22s} {"WAITS":>10s} {"RUNQ(us)":>16s} {"AVG(us)":>12s} {"P50(us)":>12s} {"P99(us)":>12s} {"MAX(us)":>12s} {"SHARE(%)":>9s}')
+    rows = [(k, v['runq'], v['overhead']) for k, v in results.items() if v.get('runq', {}).get('count')]
+    for k, e, overhead in sorted(rows, key=lambda row: row[1]['overhead'], reverse=True):
+        share = e['overhead'] / overhead * 100 if overhead else 0.0
+        lines.append(f'{k:<22s} {e["count"]:>10d} {e["overhead"]:>16.3f} {e["avg_overhead"]:>12.3f} {e["p50"]:>12.3f} {e["p99"]:>12.3f} {e["max"]:>12.3f} {share:>9.2f}')
+    return '\n'.join(lines) + '\n'
+
+def merged_runq_hist(results):
+    """
+    Return the run queue histogram of all system calls together.
+    """
+    hists = [v['runq']['hist'] for v in results.values() if 'runq' in v]
+    return [sum(buckets) for buckets in zip(*hists)]
+
+def format_log2_hist(buckets, sub_bits, width=40):
+    """
+    Render histogram <buckets> as one bar per log2 slot in us, like runqlat.
+    """
+    slots = [sum(buckets[i:i + (1 << sub_bits)]) for i in range(0, len(buckets), 1 << sub_bits)]
+    used = [i for i, count in enumerate(slots) if count]
+    if not used:
+        return 'No run queue waits.\n'
+    peak = max(slots)
+    lines = []
+    lines.append(f'{"us":>22s} : {"count":<10s} distribution')
+    for slot in range(used[0], used[-1] + 1):
+        low, _ = histogram.bucket_bounds(slot << sub_bits, sub_bits)
+        high = histogram.bucket_bounds(((slot + 1) << sub_bits) - 1, sub_bits)[1]
+        bar = '*' * round(slots[slot] / peak * width)
+        lines.append(f'{f"{low / 1e3:g} -> {high / 1e3:g}":>22s} : {slots[slot]:<10d} |{bar:<{width}s}|')
+    return '\n'.join(lines) + '\n'
+
+def format_ngram_table(sequences):
+    """
+    Render system call sequences, oldest call first, by summed latency.
+    """
+    lines = []
+    lines.append(f'{"COUNT":>10s} {"OVERHEAD(us)":>22s} {"AVG_OVERHEAD(us/seq)":>22s}  SEQUENCE')
+    for s in sequences:
+        lines.append(f'{s["count"]:>10d} {s["overhead"]:>22.3f} {s["avg_overhead"]:>22.3f}  {" -> ".join(s["syscalls"])}')
+    return '\n'.join(lines) + '\n'
+
+def format_futex_table(futexes):
+    """
+    Render per lock word wait time, each followed by the stack of its
+    slowest wait (innermost frame first) if one was recorded.
+    """
+    lines = []
+    lines.append(f'{"PID":<10s} {"NAME":<16s} {"UADDR":>18s} {"WAITS":>10s} {"WAIT(us)":>22s} {"AVG(us)":>13s} {"MAX(us)":>13s}')
+    for f in futexes:
+        lines.append(f'{f["tgid"]:<10d} {process_name(f["tgid"]):<16.16s} {f["uaddr"]:>#18x} {f["count"]:>10d} {f["overhead"]:>22.3f} {f["avg_overhead"]:>13.3f} {f["max"]:>13.3f}')
+        for frame in f['frames']:
+            lines.append(f'    {frame}')
+    return '\n'.join(lines) + '\n'
+
+def format_async_table(results):
+    """
+    Render each io_uring opcode next to the system call doing the same
+    work synchronously, if one was traced.
+    """
+    lines = []
+    lines.append(f'{"OPCODE":<22s} {"COUNT":>10s} {"AVG(us)":>13s} {"SYSCALL":<22s} {"COUNT":>10s} {"AVG(us)":>13s}')
+    sync_rows = {v['sysnum']: (k, v) for k, v in results.items() if not k.startswith('[')}
+    for k, v in sorted(results.items(), key=lambda r: r[1]['overhead'], reverse=1):
+        if not k.startswith('[async:'):
+            continue
+        line = f'{k[len("[async:"):-1]:<22s} {v["count"]:>10d} {v["avg_overhead"]:>13.3f}'
+        if v['sysnum'] in sync_rows:
+            name, s = sync_rows[v['sysnum']]
+            line += f' {name:<22s} {s["count"]:>10d} {s["avg_overhead"]:>13.3f}'
+        else:
+            line += f' {"-":<22s} {"-":>10s} {"-":>13s}'
+        lines.append(line)
+    return '\n'.join(lines) + '\n'
+
+def format_trigger_events(events, trigger_time):
+    """
+    Render (tid, sysnum, start_time, duration, ret) events with their end
+    time relative to <trigger_time>, all in ns.
+    """
+    lines = []
+    lines.append(f'{"END(us)":>13s} {"TID":<10s} {"SYSCALL":<22s} {"DURATION(us)":>13s} {"RET":>20s}')
+    for tid, sysnum, start_time, duration, ret in events:
+        end = (start_time + duration - trigger_time) / 1e3
+        lines.append(f'{end:>+13.3f} {tid:<10d} {syscall_name(sysnum):<22s} {duration / 1e3:>13.3f} {ret:>20d}')
+    return '\n'.join(lines) + '\n'
+
+def median_mad(values):
+    """
+    Return the median of <values> and their median absolute deviation from it.
+    """
+    median = statistics.median(values)
+    return median, statistics.median(abs(v - median) for v in values)
+
+def format_iterations(iterations):
+    """
+    Render one line per repeated run with its wall time and totals.
+    """
+    lines = []
+    lines.append(f'{"ITER":>4s} {"WALL(ms)":>13s} {"CALLS":>10s} {"OVERHEAD(us)":>22s}')
+    for i, (elapsed, results) in enumerate(iterations):
+        count = sum(v['count'] for v in results.values())
+        overhead = sum(v['overhead'] for v in results.values())
+        lines.append(f'{i + 1:>4d} {elapsed * 1e3:>13.3f} {count:>10d} {overhead:>22.3f}')
+    if iterations:
+        median, mad = median_mad([elapsed * 1e3 for elapsed, _ in iterations])
+        lines.append(f'Wall time: median {median:.3f} ms, MAD {mad:.3f} ms')
+    return '\n'.join(lines) + '\n'
+
+def format_repeat_table(iterations):
+    """
+    Render per-syscall medians and MADs across repeated runs, by median overhead.
+    A run that made no calls to a syscall counts as zero overhead for it.
+    """
+    names = {name for _, results in iterations for name in results}
+    rows = {}
+    for name in names:
+        runs = [results.get(name) for _, results in iterations]
+        overheads = [v['overhead'] if v else 0.0 for v in runs]
+        averages = [v['avg_overhead'] for v in runs if v]
+        rows[name] = {
+            'count': statistics.median(v['count'] if v else 0 for v in runs),
+            'overhead': median_mad(overheads),
+            'avg_overhead': median_mad(averages),
+            'min': min(overheads),
+            'max': max(overheads),
+        }
+    lines = []
+    lines.append(f'{"SYSCALL":<22s} {"COUNT":>8s} {"OVERHEAD(us)":>16s} {"MAD(us)":>13s} '
+            f'{"AVG_OVERHEAD(us/call)":>22s} {"MAD(us/call)":>13s} {"MIN(us)":>13s} {"MAX(us)":>13s}')
+    for k, v in sorted(rows.items(), key=lambda r: r[1]['overhead'][0], reverse=True):
+        lines.append(f'{k:<22s} {v["count"]:>8.1f} {v["overhead"][0]:>16.3f} {v["overhead"][1]:>13.3f} '
+                f'{v["avg_overhead"][0]:>22.3f} {v["avg_overhead"][1]:>13.3f} {v["min"]:>13.3f} {v["max"]:>13.3f}')
+    return '\n'.join(lines) + '\n'
@@ -0,0 +1,126 @@
+# bpfbench  A better benchmarking tool written in eBPF.
+# Copyright (C) 2020  William Findlay
+#
+# Heavily inspired by syscount from bcc-tools:
+# https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import errno
+import ctypes as ct
+
+from bcc.libbcc import lib
+
+# Batch lookups need bcc >= 0.19 and Linux >= 5.6
+HAVE_BATCH = hasattr(lib, 'bpf_lookup_batch')
+if HAVE_BATCH:
+    lib.bpf_lookup_batch.restype = ct.c_int
+    lib.bpf_lookup_batch.argtypes = [ct.c_int, ct.c_void_p, ct.c_void_p,
+            ct.c_void_p, ct.c_void_p, ct.POINTER(ct.c_uint32)]
+
+
+class MapSnapshot:
+    """
+    Copy of a per-CPU array whose values are all u64 fields.
+    The whole map is read with as few batch lookups as the kernel allows,
+    into buffers that are allocated once and reused by every read().
+    """
+
+    def __init__(self, table):
+        self.table = table
+        self.size = table.max_entries
+        self.ncpus = table.total_cpu
+        leaf = table.sLeaf
+        self.width = ct.sizeof(leaf) // 8
+        if hasattr(leaf, '_fields_'):
+            self.fields = {name: i for i, (name, _) in enumerate(leaf._fields_)}
+        else:
+            self.fields = {None: 0}
+        self.stride = self.ncpus * self.width
+        self.keys = (ct.c_uint32 * self.size)()
+        self.values = (ct.c_uint64 * (self.size * self.stride))()
+        self.view = memoryview(self.values).cast('B').cast('Q')
+        self.batch = HAVE_BATCH
+        self.cpus = None
+
+    def read(self):
+        """
+        Refresh the snapshot from the kernel.
+        """
+        if self.batch:
+            try:
+                self._read_batch()
+                return
+            except OSError:
+                # Old kernel, fall back to per-key lookups from now on
+                self.batch = False
+        self._read_iter()
+
+    def _read_batch(self):
+        out_batch = ct.c_uint32(0)
+        done = 0
+        while done < self.size:
+            count = ct.c_uint32(self.size - done)
+            keys = ct.byref(self.keys, done * ct.sizeof(ct.c_uint32))
+            values = ct.byref(self.values, done * self.stride * 8)
+            in_batch = ct.byref(out_batch) if done else None
+            ret = lib.bpf_lookup_batch(self.table.map_fd, in_batch,
+                    ct.byref(out_batch), keys, values, ct.byref(count))
+            done += count.value
+            if ret < 0:
+                err = ct.get_errno() or -ret
+                if err == errno.ENOENT:
+                    break
+                raise OSError(err, 'bpf_lookup_batch failed')
+        if done != self.size:
+            raise OSError(errno.EINVAL, 'short batch lookup')
+
+    def _read_iter(self):
+        for key, percpu in self.table.iteritems():
+            base = key.value * self.stride
+            for cpu, leaf in enumerate(percpu):
+                if self.width == 1:
+                    self.view[base + cpu] = leaf
+                    continue
+                for field, offset in self.fields.items():
+                    self.view[base + cpu * self.width + offset] = getattr(leaf, field)
+
+    def select(self, cpus):
+        """
+        Only include <cpus> in sum() and max(), or all CPUs if None.
+        """
+        self.cpus = [cpu for cpu in cpus if cpu < self.ncpus] if cpus is not None else None
+
+    def percpu(self, key, field=None):
+        """
+        Return the per-CPU values of <field> for <key>, for every possible CPU.
+        """
+        base = key * self.stride + self.fields[field]
+        return self.view[base:base + self.stride:self.width]
+
+    def selected(self, key, field=None):
+        """
+        Return the values of <field> for <key> on the selected CPUs.
+        """
+        values = self.percpu(key, field)
+        if self.cpus is None:
+            return values
+        return [values[cpu] for cpu in self.cpus]
+
+    def sum(self, key, field=None):
+        return sum(self.selected(key, field))
+
+    def max(self, key, field=None):
+        return max(self.selected(key, field), default=0)
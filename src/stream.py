@@ -0,0 +1,78 @@
+# bpfbench  A better benchmarking tool written in eBPF.
+# Copyright (C) 2020  William Findlay
+#
+# Heavily inspired by syscount from bcc-tools:
+# https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import struct
+
+# File header: magic, format version, record size
+MAGIC = b'BPFBSTRM'
+VERSION = 1
+HEADER = struct.Struct('<8sII')
+
+# Per-event record: tid, sysnum, start_time, duration, ret
+# Keep in sync with struct event_t in bpf/bpf_program.c
+RECORD = struct.Struct('<IIQQq')
+
+# Flush buffered records once this many bytes are pending
+FLUSH_SIZE = 1 << 16
+
+
+class StreamWriter:
+    """
+    Append fixed-size event records to a binary file in batches.
+    """
+
+    def __init__(self, f):
+        self.f = f
+        self.buf = bytearray()
+        self.events = 0
+        self.f.write(HEADER.pack(MAGIC, VERSION, RECORD.size))
+
+    def write(self, record):
+        """
+        Queue one raw record, flushing when enough are pending.
+        """
+        self.buf += record
+        self.events += 1
+        if len(self.buf) >= FLUSH_SIZE:
+            self.flush()
+
+    def flush(self):
+        self.f.write(self.buf)
+        self.f.flush()
+        self.buf.clear()
+
+    def close(self):
+        self.flush()
+        self.f.close()
+
+
+def read_events(path):
+    """
+    Yield (tid, sysnum, start_time, duration, ret) tuples from a stream file.
+    """
+    with open(path, 'rb') as f:
+        magic, version, size = HEADER.unpack(f.read(HEADER.size))
+        if magic != MAGIC or version != VERSION or size != RECORD.size:
+            raise ValueError(f'{path} is not a bpfbench stream file.')
+        while 1:
+            chunk = f.read(RECORD.size * 4096)
+            if not chunk:
+                break
+            yield from RECORD.iter_unpack(chunk[:len(chunk) - len(chunk) % RECORD.size])
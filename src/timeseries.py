@@ -0,0 +1,184 @@
+# bpfbench  A better benchmarking tool written in eBPF.
+# Copyright (C) 2020  William Findlay
+#
+# Heavily inspired by syscount from bcc-tools:
+# https://github.com/iovisor/bcc/blob/master/tools/syscount.py
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+import sys
+import mmap
+import struct
+import datetime
+
+from src import histogram, report
+
+# File header: magic, format version, buckets per row, histogram sub-bits,
+# length of the syscall name table that follows, start time in ns
+MAGIC = b'BPFBTSER'
+VERSION = 1
+HEADER = struct.Struct('<8sIIIIQ')
+
+# Fixed row prefix: timestamp ns, sysnum, padding, count, overhead ns, max ns.
+# Each row is followed by <buckets> u64 histogram buckets.
+ROW = struct.Struct('<QIIQQQ')
+TIMESTAMP = struct.Struct('<Q')
+
+
+def row_struct(nbuckets):
+    return struct.Struct(ROW.format + 'Q' * nbuckets)
+
+
+class TimeSeriesWriter:
+    """
+    Append one row per active syscall at every checkpoint.
+    Rows hold cumulative counters, so any snapshot stands on its own.
+    """
+
+    def __init__(self, f, names, nbuckets, sub_bits, start_time):
+        self.f = f
+        self.row = row_struct(nbuckets)
+        self.nbuckets = nbuckets
+        blob = '\0'.join(names).encode('utf-8')
+        self.f.write(HEADER.pack(MAGIC, VERSION, nbuckets, sub_bits, len(blob), start_time))
+        self.f.write(blob)
+        self.f.flush()
+
+    def write(self, timestamp, results):
+        """
+        Append a snapshot of cumulative <results> taken at <timestamp> ns.
+        """
+        buf = bytearray(self.row.size * len(results))
+        for i, v in enumerate(results.values()):
+            buckets = v['hist'] if self.nbuckets else ()
+            self.row.pack_into(buf, i * self.row.size, timestamp, v['sysnum'], 0,
+                    v['count'], round(v['overhead'] * 1e3), round(v['max'] * 1e3), *buckets)
+        self.f.write(buf)
+        self.f.flush()
+
+    def close(self):
+        self.f.close()
+
+
+class TimeSeriesReader:
+    """
+    Memory-mapped reader for a time-series file.
+    """
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        if len(self.map) < HEADER.size:
+            raise ValueError(f'{path} is not a bpfbench time-series file.')
+        magic, version, self.nbuckets, self.sub_bits, names_len, self.start_time = \
+                HEADER.unpack_from(self.map)
+        if magic != MAGIC or version != VERSION:
+            raise ValueError(f'{path} is not a bpfbench time-series file.')
+        offset = HEADER.size
+        self.names = self.map[offset:offset + names_len].decode('utf-8').split('\0')
+        self.row = row_struct(self.nbuckets)
+        self.rows_offset = offset + names_len
+
+    def rows(self):
+        """
+        Yield raw row tuples, ignoring a trailing partial row.
+        """
+        view = memoryview(self.map)[self.rows_offset:]
+        yield from self.row.iter_unpack(view[:len(view) - len(view) % self.row.size])
+
+    def snapshots(self):
+        """
+        Yield (timestamp ns, results) for each checkpoint in the file.
+        """
+        timestamp, results = None, {}
+        for row in self.rows():
+            if row[0] != timestamp and results:
+                yield timestamp, results
+                results = {}
+            timestamp = row[0]
+            name, result = self.to_result(row)
+            results[name] = result
+        if results:
+            yield timestamp, results
+
+    def checkpoints(self):
+        """
+        Return (timestamp ns, first row, end row) for each checkpoint in the file,
+        reading only the timestamp of each row.
+        """
+        nrows = (len(self.map) - self.rows_offset) // self.row.size
+        checkpoints = []
+        for i in range(nrows):
+            timestamp, = TIMESTAMP.unpack_from(self.map, self.rows_offset + i * self.row.size)
+            if checkpoints and checkpoints[-1][0] == timestamp:
+                continue
+            if checkpoints:
+                checkpoints[-1] = checkpoints[-1][:2] + (i,)
+            checkpoints.append((timestamp, i, nrows))
+        return checkpoints
+
+    def snapshot(self, checkpoint):
+        """
+        Return (timestamp ns, results) for one entry of checkpoints(),
+        decoding only its rows.
+        """
+        timestamp, first, end = checkpoint
+        results = {}
+        for i in range(first, end):
+            name, result = self.to_result(self.row.unpack_from(self.map,
+                    self.rows_offset + i * self.row.size))
+            results[name] = result
+        return timestamp, results
+
+    def to_result(self, row):
+        """
+        Convert a raw row into a (sysname, result) pair like get_results.
+        """
+        _, sysnum, _, count, overhead, maximum = row[:6]
+        name = self.names[sysnum] if sysnum < len(self.names) else f'[unknown: {sysnum}]'
+        result = {
+            'sysnum': sysnum,
+            'count': count,
+            'overhead': overhead / 1e3,
+            'avg_overhead': overhead / 1e3 / (count if count else 1),
+            'max': maximum / 1e3,
+        }
+        if self.nbuckets:
+            result['hist'] = list(row[6:])
+            result.update(histogram.quantiles(result['hist'], self.sub_bits, maximum))
+        return name, result
+
+
+def convert(args):
+    """
+    Print one snapshot of a time-series file as the text table.
+    """
+    reader = TimeSeriesReader(args.file)
+    checkpoints = reader.checkpoints()
+    if not checkpoints:
+        print(f'{args.file} has no snapshots yet.', file=sys.stderr)
+        return
+    try:
+        timestamp, results = reader.snapshot(checkpoints[args.at])
+    except IndexError:
+        print(f'{args.file} only has {len(checkpoints)} snapshots.', file=sys.stderr)
+        sys.exit(-1)
+    start_time = datetime.datetime.fromtimestamp(reader.start_time / 1e9)
+    curr_time = datetime.datetime.fromtimestamp(timestamp / 1e9)
+    results_str = f'Start time:   {start_time}\n'
+    results_str += f'Current time: {curr_time}\n'
+    results_str += f'Time elapsed: {(curr_time - start_time)}\n\n'
+    results_str += report.format_table(results, args.sort, args.sysnum, bool(reader.nbuckets))
+    sys.stdout.write(results_str)
@@ -18,19 +18,196 @@
 # along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 import os, sys
+import re
 import subprocess
+import functools
+import threading
+import ctypes as ct
 
 from bcc import syscall
 
+from src import defs
+
+_syscall_define = re.compile(r'^#define\s+(__NR(?:3264)?_\w+)\s+(\w+)')
+
+def parse_syscall_header(path):
+    """
+    Return {number: name} from the __NR_ definitions in a unistd header.
+    The generic table defines some calls through __NR3264_ aliases, 64-bit
+    names first, and the first name for a number wins. Optional calls inside
+    __ARCH_WANT_ blocks only get a name if nothing else has their number.
+    """
+    values, names, optional = {}, [], []
+    conditions = []
+    with open(path, 'r') as f:
+        for line in f:
+            words = line.split()
+            if not words:
+                continue
+            if words[0].startswith('#if'):
+                conditions.append(words[0] == '#ifdef' and len(words) > 1 and words[1].startswith('__ARCH_WANT_'))
+            elif words[0] == '#else' and conditions:
+                conditions[-1] = False
+            elif words[0] == '#endif' and conditions:
+                conditions.pop()
+            match = _syscall_define.match(line)
+            if not match:
+                continue
+            macro, value = match.groups()
+            values[macro] = value
+            if macro.startswith('__NR_'):
+                (optional if any(conditions) else names).append(macro)
+    table = {}
+    for macro in names + optional:
+        value = values[macro]
+        # Follow aliases such as __NR_fcntl -> __NR3264_fcntl -> 25
+        for _ in range(len(values)):
+            if value not in values:
+                break
+            value = values[value]
+        name = macro[len('__NR_'):]
+        if value.isdigit() and name not in ('syscalls', 'arch_specific_syscall'):
+            table.setdefault(int(value), name)
+    return table
+
+@functools.lru_cache(maxsize=None)
+def syscall_table():
+    """
+    Return {number: name} of the system calls of the running architecture,
+    falling back to the table BCC ships (x86_64, unless ausyscall is around).
+    """
+    uname = os.uname()
+    for path in defs.SYSCALL_HEADERS.get(uname.machine, []):
+        path = path.format(release=uname.release)
+        if os.path.isfile(path):
+            table = parse_syscall_header(path)
+            if table:
+                return table
+    return {num: name.decode('utf-8') for num, name in syscall.syscalls.items()}
+
+def num_syscalls():
+    """
+    Return the size of a table indexed by system call number.
+    Numbering has holes, e.g. x86_64 jumps from 334 to 424.
+    """
+    return max(syscall_table()) + 1
+
 def syscall_name(num):
     """
-    Return uppercase system call name.
+    Return system call name.
+    """
+    return syscall_table().get(num, f'[unknown: {num}]')
+
+def syscall_number(name):
+    """
+    Return the system call number for <name>, or None if there is no such call.
+    """
+    for num, sysname in syscall_table().items():
+        if sysname == name:
+            return num
+    return None
+
+def syscall_filter_macro(sysnums, name='SYSCALL_ALLOWED'):
+    """
+    Return a function-like macro definition <name>(nr) that tests membership
+    of a system call number in <sysnums>, as a shift-and-mask on 64-bit words.
+    """
+    words = {}
+    for num in sysnums:
+        words[num >> 6] = words.get(num >> 6, 0) | (1 << (num & 63))
+    expr = '0'
+    for word, mask in sorted(words.items(), reverse=True):
+        expr = f'(((nr) >> 6) == {word} ? ((0x{mask:x}ULL >> ((nr) & 63)) & 1) : {expr})'
+    return f'{name}(nr)=({expr})'
+
+def parse_cpu_list(value):
+    """
+    Return the sorted CPUs in a kernel cpulist such as "0-3,8,10-11".
+    Raises ValueError if <value> is malformed.
+    """
+    cpus = set()
+    for part in value.strip().split(','):
+        if not part:
+            continue
+        first, _, last = part.partition('-')
+        first = int(first)
+        last = int(last) if last else first
+        if first < 0 or last < first:
+            raise ValueError(f'invalid CPU range {part}')
+        cpus.update(range(first, last + 1))
+    return sorted(cpus)
+
+def online_cpus():
+    """
+    Return the online CPUs.
     """
-    return syscall.syscall_name(num).decode('utf-8')
+    try:
+        with open('/sys/devices/system/cpu/online', 'r') as f:
+            return parse_cpu_list(f.read())
+    except (OSError, ValueError):
+        return sorted(os.sched_getaffinity(0))
+
+def tracepoint_fields(category, event):
+    """
+    Return the field names of a tracepoint, from its tracefs format file.
+    """
+    for root in defs.TRACEFS_PATHS:
+        try:
+            with open(f'{root}/events/{category}/{event}/format', 'r') as f:
+                lines = f.readlines()
+        except OSError:
+            continue
+        # e.g. "\tfield:void * req;\toffset:16;\tsize:8;\tsigned:0;"
+        fields = set()
+        for line in lines:
+            line = line.strip()
+            if line.startswith('field:'):
+                decl = line[len('field:'):].split(';')[0]
+                fields.add(decl.split()[-1].split('[')[0])
+        return fields
+    return set()
+
+def cpu_nodes():
+    """
+    Return {cpu: NUMA node} of the online CPUs.
+    Machines without NUMA, or without the sysfs directory, are one node 0.
+    """
+    nodes = {cpu: 0 for cpu in online_cpus()}
+    root = '/sys/devices/system/node'
+    try:
+        entries = os.listdir(root)
+    except OSError:
+        return nodes
+    for entry in entries:
+        if not re.match(r'^node\d+$', entry):
+            continue
+        try:
+            with open(os.path.join(root, entry, 'cpulist'), 'r') as f:
+                cpus = parse_cpu_list(f.read())
+        except (OSError, ValueError):
+            continue
+        for cpu in cpus:
+            if cpu in nodes:
+                nodes[cpu] = int(entry[len('node'):])
+    return nodes
+
+libc = ct.CDLL(None, use_errno=True)
+
+# Held while a thread runs as the sudoer, so privileged writes happen one at a time
+privileges_lock = threading.Lock()
+
+def set_thread_ids(name, *ids):
+    """
+    Make a set*id system call for the calling thread only. The libc wrappers
+    would change every thread, including ones reading maps or /proc as root.
+    """
+    if libc.syscall(syscall_number(name), *ids) < 0:
+        errno = ct.get_errno()
+        raise OSError(errno, os.strerror(errno))
 
 def drop_privileges(function):
     """
-    Decorator to drop root
+    Decorator to drop root in the calling thread
     """
     def inner(*args, **kwargs):
         # Get sudoer's UID
@@ -45,20 +222,21 @@ def drop_privileges(function):
         except (KeyError, ValueError):
             print("Could not get GID for sudoer", file=sys.stderr)
             return
-        # Make sure groups are reset
-        try:
-            os.setgroups([])
-        except PermissionError:
-            pass
-        # Drop root
-        os.setresgid(sudo_gid, sudo_gid, -1)
-        os.setresuid(sudo_uid, sudo_uid, -1)
-        # Execute function
-        ret = function(*args, **kwargs)
-        # Get root back
-        os.setresgid(0, 0, -1)
-        os.setresuid(0, 0, -1)
-        return ret
+        with privileges_lock:
+            # Make sure groups are reset
+            try:
+                set_thread_ids('setgroups', 0, None)
+            except PermissionError:
+                pass
+            # Drop root
+            set_thread_ids('setresgid', sudo_gid, sudo_gid, -1)
+            set_thread_ids('setresuid', sudo_uid, sudo_uid, -1)
+            # Execute function, getting root back even if it fails
+            try:
+                return function(*args, **kwargs)
+            finally:
+                set_thread_ids('setresuid', 0, 0, -1)
+                set_thread_ids('setresgid', 0, 0, -1)
     return inner
 
 def which(binary):
@@ -78,3 +256,34 @@ def which(binary):
             return os.path.realpath(binary)
         else:
             raise FileNotFoundError(f"{binary} not found")
+
+def process_name(pid):
+    """
+    Return the command name of <pid>, or "?" if it has exited.
+    """
+    try:
+        with open(f'/proc/{pid}/comm', 'r') as f:
+            return f.read().strip()
+    except OSError:
+        return '?'
+
+_cgroup_paths = {}
+
+def cgroup_path(cgroup_id):
+    """
+    Return the cgroup v2 path whose inode number is <cgroup_id>.
+    The hierarchy is walked again only for ids that were never looked up,
+    and ids that are still missing are cached as '?' (the cgroup is gone).
+    """
+    if cgroup_id in _cgroup_paths:
+        return _cgroup_paths[cgroup_id]
+    for root in ['/sys/fs/cgroup/unified', '/sys/fs/cgroup']:
+        if not os.path.isdir(root):
+            continue
+        for d, _, _ in os.walk(root):
+            try:
+                _cgroup_paths.setdefault(os.stat(d).st_ino, d[len(root):] or '/')
+            except OSError:
+                pass
+        break
+    return _cgroup_paths.setdefault(cgroup_id, '?')